@@ -1,5 +1,25 @@
 #include "artifact.h"
 
+#include "server.h"
+#include "journal.h"
+
 Artifact::Artifact(Name name) : Named(name) { }
 
 Artifact::~Artifact() { }
+
+void Artifact::attach(class Server * server, Uuid id) {
+	this->server = server;
+	this->id = id;
+}
+
+void Artifact::tagChanged(const TagID& id, const TagValue * value) {
+	class Journal * journal = this->server ? this->server->getJournal() : nullptr;
+	if(journal == nullptr) {
+		return;
+	}
+	if(value) {
+		journal->setArtifactTag(this->id, id, *value);
+	} else {
+		journal->delArtifactTag(this->id, id);
+	}
+}
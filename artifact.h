@@ -1,12 +1,25 @@
 #pragma once
 
+class Server;
+
 #include "name.h"
 #include "tag.h"
+#include "uuid.h"
 
 class Artifact : public Named, public Tagged {
 public:
 	explicit Artifact(Name name);
 	~Artifact();
+
+	// Journal the changes under this id: done by the server for its artifacts.
+	void attach(class Server * server, Uuid id);
+
+protected:
+	void tagChanged(const TagID& id, const TagValue * value) override;
+
+private:
+	class Server * server = nullptr; // Not journaled while nullptr.
+	Uuid id = Uuid::fromInteger(0);
 };
 
 // TODO: add when-destroyed script.
@@ -1,13 +1,35 @@
 #include "aspect.h"
 #include "log.h"
 
-#include <map>
+#include <vector>
+#include <unordered_map>
+
+/* Table */
+
+struct AspectInfo {
+	std::string name;
+	int entry;
+	bool registered;
+	bool default_passable;
+	bool warned; // Unregistered aspects are only reported once.
+};
+std::vector<struct AspectInfo> aspectTable { {"_", 0, false, true, false} }; // Global
+std::unordered_map<std::string, std::uint32_t> aspectIds { {"_", 0} }; // Global
+unsigned long aspectRegistryRevision = 0; // Global
+
+static struct AspectInfo& getAspectInfo(const Aspect& aspect) {
+	struct AspectInfo& info = aspectTable[aspect.toId()];
+	if(not info.registered and not info.warned) {
+		warning("Aspect '"+info.name+"' isn't registered.");
+		info.warned = true;
+	}
+	return(info);
+}
 
 /* Aspect */
 
-Aspect::Aspect(std::string string) :
-	data { "" }
-{
+Aspect::Aspect(std::string string) {
+	std::string data;
 	for(auto c : string) {
 		if(
 			(c >= 'a' and c <= 'z')
@@ -21,65 +43,68 @@ Aspect::Aspect(std::string string) :
 			or c == ':'
 			// or c == ' ' // Not allowed.
 		) {
-			data.append(std::string{c});
-		}
-		/*
-		else {
-			data.append(std::string{'?'});
+			data.push_back(c);
 		}
-		*/
 	}
 
 	if(data == "") {
 		data = "_";
 	}
+
+	// Intern.
+	auto it = aspectIds.find(data);
+	if(it != aspectIds.end()) {
+		this->id = it->second;
+	} else {
+		this->id = aspectTable.size();
+		aspectIds.emplace(data, this->id);
+		aspectTable.push_back({data, 0, false, true, false});
+	}
 }
 
 bool Aspect::operator == (const Aspect& rhs) const {
-	return(data == rhs.data);
+	return(id == rhs.id);
 }
 
 bool Aspect::operator < (const Aspect& rhs) const {
-	return(data < rhs.data);
+	return(id < rhs.id);
 }
 
 const std::string& Aspect::toString() const {
-	return(data);
+	return(aspectTable[id].name);
 }
 
 int Aspect::toEntry() const {
-	return(getAspectEntry(*this));
+	return(getAspectInfo(*this).entry);
 }
 
-/* Static */
+std::uint32_t Aspect::toId() const {
+	return(id);
+}
 
-std::map<class Aspect, int> aspectEntries; // Global
-std::map<class Aspect, bool> aspectDefaultPassable; // Global
+/* Static */
 
 void Aspect::registerAspect(const Aspect& aspect, int entry, bool default_passable) {
-	if(aspectEntries.count(aspect) > 0) {
+	struct AspectInfo& info = aspectTable[aspect.toId()];
+	if(info.registered) {
 		warning("Aspect '"+aspect.toString()+"' redefined.");
 	}
-	aspectEntries[aspect] = entry;
-	aspectDefaultPassable[aspect] = default_passable;
+	info.entry = entry;
+	info.registered = true;
+	info.default_passable = default_passable;
+	aspectRegistryRevision++;
 }
 
 int Aspect::getAspectEntry(const Aspect& aspect) {
-	try {
-		return(aspectEntries.at(aspect));
-	} catch(const std::out_of_range& oor) {
-		warning("Aspect '"+aspect.toString()+"' isn't registered.");
-		return(0);
-	}
+	return(getAspectInfo(aspect).entry);
 }
 
 bool Aspect::getAspectDefaultPassable(const Aspect& aspect) {
-	try {
-		return(aspectDefaultPassable.at(aspect));
-	} catch(const std::out_of_range& oor) {
-		warning("Aspect '"+aspect.toString()+"' isn't registered.");
-		return(true);
-	}
+	return(getAspectInfo(aspect).default_passable);
+}
+
+unsigned long Aspect::getRegistryRevision() {
+	return(aspectRegistryRevision);
 }
 
 /* Aspected */
@@ -1,23 +1,28 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
+// Handle into a global table of aspects: copies and comparisons are
+// integer ones, the string and the entry are looked up by index.
 class Aspect {
 public:
 	explicit Aspect(std::string string);
-	Aspect() : Aspect("_") {}; // Default
+	Aspect() : id(0) {}; // Default: "_".
 	bool operator == (const Aspect& rhs) const;
 	bool operator != (const Aspect& rhs) const { return(not (*this == rhs) ); }
 	bool operator < (const Aspect& rhs) const;
 	const std::string& toString() const;
 	int toEntry() const;
+	std::uint32_t toId() const;
 
 	static void registerAspect(const Aspect& aspect, int entry, bool default_passable = true);
 	static int getAspectEntry(const Aspect& aspect);
 	static bool getAspectDefaultPassable(const Aspect& aspect);
+	static unsigned long getRegistryRevision(); // Changes whenever an aspect is registered.
 
 private:
-	std::string data;
+	std::uint32_t id; // In the aspect table.
 };
 
 class Aspected {
@@ -0,0 +1,294 @@
+#include "server.h"
+#include "zone.h"
+#include "character.h"
+#include "player.h"
+#include "inventory.h"
+#include "aspect.h"
+#include "tag.h"
+#include "uuid.h"
+#include "metrics.h"
+#include "log.h"
+
+#include <fcntl.h> // open()
+#include <getopt.h> // getopt()
+#include <signal.h> // signal()
+#include <algorithm> // std::find(), std::nth_element(), std::shuffle()
+#include <cstdio> // printf()
+#include <cstdint> // SIZE_MAX
+#include <cstdlib> // atoi()
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define BENCH_SEED 42 // Same workloads on every run.
+#define BENCH_RUNS 15 // Median of.
+#define BENCH_SAMPLE 20 // Milliseconds a run lasts at least: far above the clock's resolution.
+#define BENCH_TOLERANCE 50 // Percent slower than the baseline before failing: machines are noisy.
+
+// Keep results alive, so the work isn't optimized away.
+static volatile std::uint64_t sink;
+
+// Median time per operation of several runs, in nanoseconds. ops is doubled
+// until a run lasts BENCH_SAMPLE, so run() must accept any multiple of it.
+static double measure(std::uint64_t ops, const std::function<void(std::uint64_t)>& run, const std::function<void()>& after = nullptr) {
+	std::vector<double> samples;
+	while(samples.size() < BENCH_RUNS) {
+		std::uint64_t start = Metrics::now();
+		run(ops);
+		std::uint64_t elapsed = Metrics::now() - start;
+		if(after) {
+			after();
+		}
+		if(samples.empty() and elapsed < BENCH_SAMPLE * 1000000ull) {
+			ops *= 2; // Too short: this one only warmed up.
+			continue;
+		}
+		samples.push_back((double) elapsed / ops);
+	}
+	std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+	return(samples[samples.size() / 2]);
+}
+
+/* Workloads */
+
+// Free space of inventories holding 64 kinds of items, in a shuffled order:
+// a different one each time, so the read can't be hoisted out of the loop.
+static double inventoryAvailable() {
+	const unsigned int count = 64; // A power of 2: indexes are masked.
+	std::vector<std::unique_ptr<Inventory>> inventories;
+	for(unsigned int n = 0; n < count; n++) {
+		inventories.emplace_back(new Inventory(1000000 + n));
+		for(unsigned int item = 0; item < 64; item++) {
+			inventories.back()->add(item + n + 1, "item_"+std::to_string(item));
+		}
+	}
+	std::vector<Inventory *> order;
+	for(auto& inventory : inventories) {
+		order.push_back(inventory.get());
+	}
+	std::mt19937 random { BENCH_SEED };
+	std::shuffle(order.begin(), order.end(), random);
+	return(measure(1000000, [&](std::uint64_t ops) {
+		std::uint64_t total = 0;
+		for(std::uint64_t i = 0; i < ops; i++) {
+			total += order[i & (count - 1)]->available();
+		}
+		sink = total;
+	}));
+}
+
+// Loot transfer: one of each of 256 kinds, back and forth.
+static double inventoryMoveAll() {
+	Inventory from { 100000 };
+	Inventory to { 100000 };
+	std::vector<std::string> names;
+	for(unsigned int item = 0; item < 256; item++) {
+		names.push_back("item_"+std::to_string(item));
+		from.add(1, names.back());
+	}
+	// Whole round trips: every item is back in 'from' after each run.
+	return(measure(names.size() * 2 * 200, [&](std::uint64_t ops) {
+		std::uint64_t moved = 0;
+		for(std::uint64_t i = 0; i < ops; i++) {
+			const std::string& name = names[i % names.size()];
+			moved += ((i / names.size()) % 2 ? to : from).move_all(1, name, (i / names.size()) % 2 ? from : to);
+		}
+		sink = moved;
+	}));
+}
+
+// Tags of a 32 tags object, 1 in 4 missing.
+static double taggedGetTag() {
+	std::mt19937 random { BENCH_SEED };
+	Tagged tagged;
+	for(unsigned int tag = 0; tag < 32; tag++) {
+		tagged.setTag(TagID{"tag_"+std::to_string(tag)}, TagValue{std::to_string(tag)});
+	}
+	std::vector<TagID> ids;
+	for(unsigned int i = 0; i < 4096; i++) {
+		ids.emplace_back("tag_"+std::to_string(random() % 43));
+	}
+	return(measure(1000000, [&](std::uint64_t ops) {
+		std::uint64_t length = 0;
+		for(std::uint64_t i = 0; i < ops; i++) {
+			length += tagged.getTag(ids[i % ids.size()]).toString().length();
+		}
+		sink = length;
+	}));
+}
+
+// Entries of 256 registered aspects.
+static double aspectEntry() {
+	std::mt19937 random { BENCH_SEED };
+	std::vector<Aspect> aspects;
+	for(unsigned int aspect = 0; aspect < 256; aspect++) {
+		aspects.emplace_back("bench_aspect_"+std::to_string(aspect));
+		Aspect::registerAspect(aspects.back(), aspect);
+	}
+	std::vector<Aspect> lookups;
+	for(unsigned int i = 0; i < 4096; i++) {
+		lookups.push_back(aspects[random() % aspects.size()]);
+	}
+	return(measure(1000000, [&](std::uint64_t ops) {
+		std::uint64_t total = 0;
+		for(std::uint64_t i = 0; i < ops; i++) {
+			total += Aspect::getAspectEntry(lookups[i % lookups.size()]);
+		}
+		sink = total;
+	}));
+}
+
+// Id to string and back, as the protocol and Lua do.
+static double uuidRoundTrip() {
+	std::mt19937_64 random { BENCH_SEED };
+	std::vector<Uuid> ids;
+	for(unsigned int i = 0; i < 4096; i++) {
+		ids.push_back(Uuid::fromInteger(random() >> (random() % 64)));
+	}
+	return(measure(1000000, [&](std::uint64_t ops) {
+		std::uint64_t same = 0;
+		for(std::uint64_t i = 0; i < ops; i++) {
+			const Uuid& id = ids[i % ids.size()];
+			same += Uuid(id.toString().c_str()) == id;
+		}
+		sink = same;
+	}));
+}
+
+// A character moving among 500 players who all see it.
+static double zoneFanOut() {
+	std::mt19937 random { BENCH_SEED };
+	// No console nor init.lua: only the zone and its characters.
+	class Server * server = new Server(false);
+	class Zone * zone = new Zone(server, "bench", Name{"Bench"}, 128, 128, Aspect{});
+	zone->setViewRadius(0);
+	Aspect::registerAspect(Aspect{}, 0);
+	Player::setOutputLimit(SIZE_MAX);
+	std::vector<class Character *> characters;
+	std::vector<class Player *> players;
+	for(unsigned int i = 0; i < 500; i++) {
+		class Character * character = new Character(Uuid{}, Name{"bot"}, Aspect{});
+		server->addCharacter(character);
+		character->changeZone(zone, random() % 128, random() % 128);
+		class Player * player = new Player(open("/dev/null", O_WRONLY | O_CLOEXEC), character);
+		character->setPlayer(player);
+		characters.push_back(character);
+		players.push_back(player);
+	}
+	auto flush = [&]() {
+		for(class Player * player : players) {
+			player->flush();
+		}
+	};
+	flush();
+	// Queues are written to /dev/null between runs. The server is left to the end of the process.
+	return(measure(100, [&](std::uint64_t ops) {
+		for(std::uint64_t i = 0; i < ops; i++) {
+			class Character * character = characters[random() % characters.size()];
+			character->setXY(random() % 128, random() % 128);
+		}
+	}, flush));
+}
+
+// Tolerances in percent: the shortest operations are the noisiest.
+struct Benchmark { std::string name; std::function<double()> run; int tolerance; };
+static const std::vector<struct Benchmark> benchmarks {
+	{ "inventory_available", inventoryAvailable, 150 },
+	{ "inventory_move_all", inventoryMoveAll, BENCH_TOLERANCE },
+	{ "tagged_get_tag", taggedGetTag, BENCH_TOLERANCE },
+	{ "aspect_entry", aspectEntry, 100 },
+	{ "uuid_round_trip", uuidRoundTrip, BENCH_TOLERANCE },
+	{ "zone_fan_out", zoneFanOut, BENCH_TOLERANCE },
+};
+
+/* Main */
+
+static std::map<std::string, double> loadBaseline(const std::string& filename) {
+	std::map<std::string, double> baseline;
+	std::ifstream file { filename };
+	std::string line;
+	while(std::getline(file, line)) {
+		if(line.empty() or line[0] == '#') {
+			continue;
+		}
+		std::size_t separator = line.find(' ');
+		if(separator != std::string::npos) {
+			baseline[line.substr(0, separator)] = atof(line.substr(separator + 1).c_str());
+		}
+	}
+	return(baseline);
+}
+
+static void usage(const char * name) {
+	fprintf(stderr,
+		"Usage: %s [-b baseline] [-w baseline] [-t tolerance_%%] [name]...\n"
+		"Print the nanoseconds per operation of each benchmark, or of the named ones.\n"
+		"-b fails if one is slower than its baseline by more than its tolerance\n"
+		"   (%d%% for most), or than the one given by -t.\n"
+		"-w writes the results as the new baseline.\n",
+		name, BENCH_TOLERANCE);
+}
+
+int main(int argc, char ** argv) {
+	signal(SIGPIPE, SIG_IGN);
+	setNoVerbose();
+
+	std::string check;
+	std::string write;
+	int tolerance = -1; // Each benchmark's own.
+	int opt;
+	while((opt = getopt(argc, argv, "b:w:t:")) != -1) {
+		switch(opt) {
+			case 'b': check = optarg; break;
+			case 'w': write = optarg; break;
+			case 't': tolerance = atoi(optarg); break;
+			default: usage(argv[0]); return(1);
+		}
+	}
+	std::vector<std::string> names(argv + optind, argv + argc);
+
+	std::map<std::string, double> baseline;
+	if(not check.empty()) {
+		baseline = loadBaseline(check);
+		if(baseline.empty()) {
+			fprintf(stderr, "No baseline in %s\n", check.c_str());
+			return(1);
+		}
+	}
+
+	std::string results = "# Nanoseconds per operation, median of "+std::to_string(BENCH_RUNS)+" runs.\n";
+	bool regressed = false;
+	for(const struct Benchmark& benchmark : benchmarks) {
+		if(not names.empty() and std::find(names.begin(), names.end(), benchmark.name) == names.end()) {
+			continue;
+		}
+		double ns = benchmark.run();
+		char result[64];
+		snprintf(result, sizeof(result), "%.2f", ns);
+		results += benchmark.name+" "+result+"\n";
+
+		auto reference = baseline.find(benchmark.name);
+		if(reference == baseline.end()) {
+			printf("%-24s %12.2f ns\n", benchmark.name.c_str(), ns);
+			continue;
+		}
+		double change = (ns / reference->second - 1) * 100;
+		bool slower = change > (tolerance >= 0 ? tolerance : benchmark.tolerance);
+		regressed = regressed or slower;
+		printf("%-24s %12.2f ns %+8.1f%%%s\n", benchmark.name.c_str(), ns, change, slower ? "  REGRESSION" : "");
+	}
+
+	if(not write.empty()) {
+		std::ofstream file { write };
+		file << results;
+		if(not file) {
+			fprintf(stderr, "Unable to write %s\n", write.c_str());
+			return(1);
+		}
+	}
+	return(regressed ? 1 : 0);
+}
@@ -0,0 +1,160 @@
+#include "binary.h"
+
+#include "log.h"
+
+#include <unistd.h> // write(), close(), fsync()
+#include <fcntl.h> // open()
+#include <sys/mman.h> // mmap(), munmap()
+#include <sys/stat.h> // fstat()
+#include <cstdio> // rename()
+#include <cstring> // memcpy()
+#include <cerrno>
+
+/* Writer */
+
+void BinaryWriter::put8(std::uint8_t value) {
+	this->putBytes(&value, sizeof(value));
+}
+
+void BinaryWriter::put16(std::uint16_t value) {
+	this->putBytes(&value, sizeof(value));
+}
+
+void BinaryWriter::put32(std::uint32_t value) {
+	this->putBytes(&value, sizeof(value));
+}
+
+void BinaryWriter::put64(std::uint64_t value) {
+	this->putBytes(&value, sizeof(value));
+}
+
+void BinaryWriter::putString(const std::string& value) {
+	this->put32(value.length());
+	this->putBytes(value.data(), value.length());
+}
+
+void BinaryWriter::putBytes(const void * data, std::size_t length) {
+	this->data.append(static_cast<const char *>(data), length);
+}
+
+const std::string& BinaryWriter::getData() const {
+	return(this->data);
+}
+
+void BinaryWriter::clear() {
+	this->data.clear();
+}
+
+bool BinaryWriter::save(const std::string& filename) const {
+	std::string temporary = filename + ".tmp";
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd == -1) {
+		warning("Unable to open '"+temporary+"' for writing.");
+		return(false);
+	}
+	std::size_t done = 0;
+	while(done < this->data.length()) {
+		ssize_t written = write(fd, this->data.data() + done, this->data.length() - done);
+		if(written == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			warning("Unable to write '"+temporary+"'.");
+			close(fd);
+			return(false);
+		}
+		done += written;
+	}
+	fsync(fd);
+	close(fd);
+	if(rename(temporary.c_str(), filename.c_str()) == -1) {
+		warning("Unable to rename '"+temporary+"' to '"+filename+"'.");
+		return(false);
+	}
+	return(true);
+}
+
+/* Reader */
+
+BinaryReader::BinaryReader(const std::string& filename) {
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd == -1) {
+		return;
+	}
+	struct stat st;
+	if(fstat(fd, &st) == 0 and st.st_size > 0) {
+		void * mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mapping != MAP_FAILED) {
+			this->base = static_cast<const char *>(mapping);
+			this->size = st.st_size;
+			this->valid = true;
+		}
+	}
+	close(fd); // The mapping stays.
+}
+
+BinaryReader::~BinaryReader() {
+	if(this->base) {
+		munmap(const_cast<char *>(this->base), this->size);
+	}
+}
+
+bool BinaryReader::isOpen() const {
+	return(this->base != nullptr);
+}
+
+bool BinaryReader::isValid() const {
+	return(this->valid);
+}
+
+std::size_t BinaryReader::getSize() const {
+	return(this->size);
+}
+
+std::size_t BinaryReader::getRemaining() const {
+	return(this->size - this->offset);
+}
+
+std::uint8_t BinaryReader::get8() {
+	std::uint8_t value = 0;
+	const char * bytes = this->getBytes(sizeof(value));
+	if(bytes) memcpy(&value, bytes, sizeof(value));
+	return(value);
+}
+
+std::uint16_t BinaryReader::get16() {
+	std::uint16_t value = 0;
+	const char * bytes = this->getBytes(sizeof(value));
+	if(bytes) memcpy(&value, bytes, sizeof(value));
+	return(value);
+}
+
+std::uint32_t BinaryReader::get32() {
+	std::uint32_t value = 0;
+	const char * bytes = this->getBytes(sizeof(value));
+	if(bytes) memcpy(&value, bytes, sizeof(value));
+	return(value);
+}
+
+std::uint64_t BinaryReader::get64() {
+	std::uint64_t value = 0;
+	const char * bytes = this->getBytes(sizeof(value));
+	if(bytes) memcpy(&value, bytes, sizeof(value));
+	return(value);
+}
+
+std::string BinaryReader::getString() {
+	std::uint32_t length = this->get32();
+	const char * bytes = this->getBytes(length);
+	return(bytes ? std::string(bytes, length) : std::string());
+}
+
+const char * BinaryReader::getBytes(std::size_t length) {
+	if(not this->valid or length > this->size - this->offset) {
+		this->valid = false;
+		return(nullptr);
+	}
+	const char * bytes = this->base + this->offset;
+	this->offset += length;
+	return(bytes);
+}
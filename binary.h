@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Binary files in native byte order, without alignment: they are meant to
+// be read back on the machine that wrote them.
+
+class BinaryWriter {
+public:
+	void put8(std::uint8_t value);
+	void put16(std::uint16_t value);
+	void put32(std::uint32_t value);
+	void put64(std::uint64_t value);
+	void putString(const std::string& value); // 32 bits length, then bytes.
+	void putBytes(const void * data, std::size_t length);
+
+	const std::string& getData() const;
+	void clear();
+
+	// Write in a temporary file, then rename it: readers never see half a file.
+	bool save(const std::string& filename) const;
+
+private:
+	std::string data;
+};
+
+class BinaryReader {
+public:
+	explicit BinaryReader(const std::string& filename); // The file is mmap()ed.
+	~BinaryReader();
+
+	BinaryReader(BinaryReader const &) = delete;
+	void operator=(BinaryReader const &) = delete;
+
+	bool isOpen() const;
+	bool isValid() const; // Nothing read past the end yet.
+	std::size_t getSize() const;
+	std::size_t getRemaining() const;
+
+	// Past the end, they return 0, "" or nullptr and invalidate the reader.
+	std::uint8_t get8();
+	std::uint16_t get16();
+	std::uint32_t get32();
+	std::uint64_t get64();
+	std::string getString();
+	const char * getBytes(std::size_t length); // Points into the mapping.
+
+private:
+	const char * base = nullptr;
+	std::size_t size = 0;
+	std::size_t offset = 0;
+	bool valid = false;
+};
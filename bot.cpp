@@ -0,0 +1,427 @@
+#include "bot.h"
+
+#include <unistd.h> // close(), read(), write()
+#include <getopt.h> // getopt()
+#include <signal.h> // signal()
+#include <sys/socket.h> // socket(), connect()
+#include <netinet/in.h> // IPv4
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <arpa/inet.h> // inet_pton()
+#include <sys/epoll.h> // epoll_create1(), epoll_ctl(), epoll_wait()
+#include <sys/resource.h> // setrlimit()
+#include <algorithm> // std::max(), std::min()
+#include <cerrno>
+#include <cstdio> // fprintf(), snprintf()
+#include <cstdlib> // strtoul()
+#include <cstring> // memchr(), memmove()
+#include <fstream>
+
+static const char * command_names[COMMAND_COUNT] = { "connect", "move", "say", "action" };
+static const char * directions[4] = { "north", "east", "south", "west" };
+
+/* Swarm */
+
+Swarm::Swarm(const BotOptions& options) :
+	options(options)
+{
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+Swarm::~Swarm() {
+	close(this->epoll_fd);
+}
+
+struct Level Swarm::run(unsigned int count) {
+	this->level = Level();
+	this->level.bots = count;
+	this->bots = std::vector<struct Bot>(count);
+	this->schedule = decltype(this->schedule)();
+	this->measuring = false;
+
+	// Open connections at the ramp rate, then measure for the duration.
+	std::uint64_t start = Metrics::now();
+	std::uint64_t spacing = 1000000000ull / std::max(1u, this->options.ramp);
+	for(unsigned int id = 0; id < count; id++) {
+		this->bots[id].random.seed(this->options.seed + id);
+		this->bots[id].direction = this->bots[id].random() % 4;
+		this->at(id, start + id * spacing);
+	}
+	std::uint64_t steady = start + count * spacing + this->options.timeout * 1000000ull;
+	std::uint64_t end = steady + this->options.duration * 1000000000ull;
+
+	struct epoll_event events[BOT_EPOLL_EVENTS];
+	std::uint64_t now = start;
+	while(now < end) {
+		this->measuring = now >= steady;
+
+		// Sleep until the next command, at most until the end.
+		std::uint64_t wake = end;
+		if(not this->schedule.empty()) {
+			wake = std::min(wake, this->schedule.top().first);
+		}
+		int timeout = wake > now ? (wake - now + 999999) / 1000000 : 0;
+		int n = epoll_wait(this->epoll_fd, events, BOT_EPOLL_EVENTS, timeout);
+		for(int i = 0; i < n; i++) {
+			unsigned int id = events[i].data.u32;
+			if(this->bots[id].fd == -1) {
+				continue; // Dropped by a previous event.
+			}
+			if(events[i].events & EPOLLOUT) {
+				this->flush(id);
+			}
+			if(this->bots[id].fd != -1 and (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+				this->receive(id);
+			}
+		}
+
+		now = Metrics::now();
+		while(not this->schedule.empty() and this->schedule.top().first <= now) {
+			std::pair<std::uint64_t, unsigned int> event = this->schedule.top();
+			this->schedule.pop();
+			if(this->bots[event.second].next_at == event.first) {
+				this->wake(event.second, now);
+			}
+		}
+	}
+
+	this->level.seconds = (now - steady) / 1e9;
+	for(unsigned int id = 0; id < count; id++) {
+		if(this->bots[id].fd != -1) {
+			close(this->bots[id].fd);
+		}
+	}
+	this->bots.clear();
+	return(this->level);
+}
+
+std::string Swarm::report(const BotOptions& options, const std::vector<struct Level>& levels) {
+	std::string json = "{\"host\":\""+options.host+"\""
+		+ ",\"port\":"+std::to_string(options.port)
+		+ ",\"seed\":"+std::to_string(options.seed)
+		+ ",\"duration\":"+std::to_string(options.duration)
+		+ ",\"think_ms\":"+std::to_string(options.think)
+		+ ",\"timeout_ms\":"+std::to_string(options.timeout)
+		+ ",\"chat_percent\":"+std::to_string(options.chat)
+		+ ",\"action_percent\":"+std::to_string(options.actions.empty() ? 0 : options.act)
+		+ ",\"levels\":[";
+	for(std::size_t i = 0; i < levels.size(); i++) {
+		const struct Level& level = levels[i];
+		json += std::string(i ? "," : "")
+			+ "{\"bots\":"+std::to_string(level.bots)
+			+ ",\"connected\":"+std::to_string(level.connected)
+			+ ",\"failed\":"+std::to_string(level.failed)
+			+ ",\"disconnected\":"+std::to_string(level.disconnected)
+			+ ",\"lines\":"+std::to_string(level.lines)
+			+ ",\"bytes\":"+std::to_string(level.bytes)
+			+ ",\"late\":"+std::to_string(level.late)
+			+ ",\"commands\":{";
+		for(unsigned int command = 0; command < COMMAND_COUNT; command++) {
+			const struct CommandStats& stats = level.commands[command];
+			const Histogram& latency = stats.latency;
+			char rate[32];
+			snprintf(rate, sizeof(rate), "%.1f", level.seconds > 0 ? latency.getCount() / level.seconds : 0.0);
+			json += std::string(command ? "," : "")
+				+ "\""+command_names[command]+"\":{"
+				+ "\"sent\":"+std::to_string(stats.sent)
+				+ ",\"answered\":"+std::to_string(latency.getCount())
+				+ ",\"timeouts\":"+std::to_string(stats.timeouts)
+				+ ",\"per_second\":"+rate
+				+ ",\"mean_us\":"+std::to_string(latency.getCount() ? latency.getSum() / latency.getCount() / 1000 : 0)
+				+ ",\"p50_us\":"+std::to_string(latency.getPercentile(50) / 1000)
+				+ ",\"p90_us\":"+std::to_string(latency.getPercentile(90) / 1000)
+				+ ",\"p99_us\":"+std::to_string(latency.getPercentile(99) / 1000)
+				+ ",\"p999_us\":"+std::to_string(latency.getPercentile(99.9) / 1000)
+				+ ",\"max_us\":"+std::to_string(latency.getMax() / 1000)
+				+ "}";
+		}
+		json += "}}";
+	}
+	json += "]}\n";
+	return(json);
+}
+
+/* Private */
+
+void Swarm::at(unsigned int id, std::uint64_t time) {
+	this->bots[id].next_at = time;
+	this->schedule.emplace(time, id);
+}
+
+void Swarm::wake(unsigned int id, std::uint64_t now) {
+	struct Bot& bot = this->bots[id];
+	if(bot.fd == -1) {
+		if(bot.sent_at == 0) {
+			this->connect(id, now);
+		}
+		return;
+	}
+	if(bot.seq != 0) {
+		// Still unanswered: lost, move on.
+		if(bot.measuring or bot.pending == COMMAND_CONNECT) {
+			this->level.commands[bot.pending].timeouts++;
+		}
+		bot.seq = 0;
+		if(not bot.connected) {
+			this->level.failed++;
+			this->drop(id);
+			return;
+		}
+	}
+	this->command(id, now);
+}
+
+void Swarm::connect(unsigned int id, std::uint64_t now) {
+	struct Bot& bot = this->bots[id];
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd == -1) {
+		this->level.failed++;
+		return;
+	}
+	int yes = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+	struct sockaddr_in addr {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(this->options.port);
+	inet_pton(AF_INET, this->options.host.c_str(), &addr.sin_addr);
+	if(::connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 and errno != EINPROGRESS) {
+		this->level.failed++;
+		close(fd);
+		return;
+	}
+
+	bot.fd = fd;
+	struct epoll_event event {};
+	event.events = EPOLLIN;
+	event.data.u32 = id;
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+	// Connected once the first ping is answered, after the spawn messages.
+	bot.pending = COMMAND_CONNECT;
+	bot.seq = ++this->last_seq;
+	bot.sent_at = now;
+	bot.measuring = this->measuring;
+	this->level.commands[COMMAND_CONNECT].sent++;
+	this->send(id, "ping "+std::to_string(bot.seq)+"\n");
+	this->at(id, now + this->options.timeout * 1000000ull);
+}
+
+void Swarm::command(unsigned int id, std::uint64_t now) {
+	struct Bot& bot = this->bots[id];
+	unsigned int roll = bot.random() % 100;
+	std::string message;
+	if(roll < this->options.chat) {
+		bot.pending = COMMAND_SAY;
+		message = "say bot"+std::to_string(id)+" "+std::to_string(this->last_seq + 1);
+	} else if(not this->options.actions.empty() and roll < this->options.chat + this->options.act) {
+		bot.pending = COMMAND_ACTION;
+		message = "/"+this->options.actions[bot.random() % this->options.actions.size()];
+	} else {
+		// Random walk: mostly keep going, sometimes turn.
+		bot.pending = COMMAND_MOVE;
+		if(bot.random() % 4 == 0) {
+			bot.direction = bot.random() % 4;
+		}
+		message = std::string("move ")+directions[bot.direction];
+	}
+
+	bot.seq = ++this->last_seq;
+	bot.sent_at = now;
+	bot.measuring = this->measuring;
+	if(bot.measuring) {
+		this->level.commands[bot.pending].sent++;
+	}
+	this->send(id, message+"\nping "+std::to_string(bot.seq)+"\n");
+	this->at(id, now + this->options.timeout * 1000000ull);
+}
+
+void Swarm::receive(unsigned int id) {
+	struct Bot& bot = this->bots[id];
+	ssize_t flag = read(bot.fd, bot.input + bot.input_length, BOT_INPUT_SIZE - bot.input_length);
+	if(flag == -1 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+		return;
+	}
+	if(flag <= 0) {
+		if(bot.connected) {
+			this->level.disconnected++;
+		} else {
+			this->level.failed++;
+		}
+		this->drop(id);
+		return;
+	}
+	bot.input_length += flag;
+	if(bot.measuring) {
+		this->level.bytes += flag;
+	}
+
+	// Parse every complete line, keep the rest.
+	std::size_t start = 0;
+	while(bot.fd != -1) {
+		const char * end = (const char *) memchr(bot.input + start, '\n', bot.input_length - start);
+		if(end == nullptr) {
+			break;
+		}
+		std::size_t length = end - (bot.input + start);
+		this->parse(id, bot.input + start, length);
+		start += length + 1;
+	}
+	if(start == 0 and bot.input_length == BOT_INPUT_SIZE) {
+		start = bot.input_length; // Too long (floor dump): skip it.
+	}
+	bot.input_length -= start;
+	memmove(bot.input, bot.input + start, bot.input_length);
+}
+
+void Swarm::parse(unsigned int id, const char * line, std::size_t length) {
+	struct Bot& bot = this->bots[id];
+	if(bot.measuring) {
+		this->level.lines++;
+	}
+	if(length > 5 and memcmp(line, "pong ", 5) == 0) {
+		std::uint64_t seq = strtoull(std::string(line + 5, length - 5).c_str(), nullptr, 10);
+		if(seq != bot.seq) {
+			if(bot.measuring) {
+				this->level.late++;
+			}
+			return;
+		}
+		std::uint64_t now = Metrics::now();
+		if(bot.measuring or bot.pending == COMMAND_CONNECT) {
+			this->level.commands[bot.pending].latency.record(now - bot.sent_at);
+		}
+		if(bot.pending == COMMAND_CONNECT) {
+			bot.connected = true;
+			this->level.connected++;
+		}
+		bot.seq = 0;
+
+		// Think for half to one and a half of the average.
+		std::uint64_t think = this->options.think * 1000000ull;
+		this->at(id, now + think / 2 + (think ? bot.random() % think : 0));
+	}
+}
+
+void Swarm::send(unsigned int id, const std::string& message) {
+	struct Bot& bot = this->bots[id];
+	bool idle = bot.output.empty();
+	bot.output += message;
+	if(idle) {
+		this->flush(id);
+	}
+}
+
+void Swarm::flush(unsigned int id) {
+	struct Bot& bot = this->bots[id];
+	while(not bot.output.empty()) {
+		ssize_t written = write(bot.fd, bot.output.data(), bot.output.length());
+		if(written == -1) {
+			if(errno != EAGAIN and errno != EWOULDBLOCK and errno != ENOTCONN) {
+				break; // Reported by the next read.
+			}
+			// Connecting, or the socket buffer is full.
+			struct epoll_event event {};
+			event.events = EPOLLIN | EPOLLOUT;
+			event.data.u32 = id;
+			epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, bot.fd, &event);
+			return;
+		}
+		bot.output.erase(0, written);
+	}
+	struct epoll_event event {};
+	event.events = EPOLLIN;
+	event.data.u32 = id;
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, bot.fd, &event);
+}
+
+void Swarm::drop(unsigned int id) {
+	struct Bot& bot = this->bots[id];
+	close(bot.fd); // Also removes it from epoll.
+	bot.fd = -1;
+	bot.seq = 0;
+	bot.output.clear();
+	bot.next_at = 0;
+}
+
+/* Main */
+
+static std::vector<unsigned int> parseLevels(const char * arg) {
+	std::vector<unsigned int> levels;
+	char * end;
+	do {
+		levels.push_back(strtoul(arg, &end, 10));
+		arg = end + 1;
+	} while(*end == ',');
+	return(levels);
+}
+
+static void usage(const char * name) {
+	fprintf(stderr,
+		"Usage: %s -p port [-h host] [-n bots[,bots...]] [-d seconds] [-r connections/s]\n"
+		"       [-t think_ms] [-T timeout_ms] [-c chat_%%] [-a action]... [-A action_%%]\n"
+		"       [-s seed] [-o report.json]\n"
+		"Each level of bots runs in turn: walks, chats and actions, with round trips\n"
+		"measured by pings. The report is JSON, to stdout by default.\n",
+		name);
+}
+
+int main(int argc, char ** argv) {
+	signal(SIGPIPE, SIG_IGN); // Ignore broken pipes.
+
+	BotOptions options;
+	std::string output;
+	int opt;
+	while((opt = getopt(argc, argv, "h:p:n:d:r:t:T:c:a:A:s:o:")) != -1) {
+		switch(opt) {
+			case 'h': options.host = optarg; break;
+			case 'p': options.port = atoi(optarg); break;
+			case 'n': options.levels = parseLevels(optarg); break;
+			case 'd': options.duration = atoi(optarg); break;
+			case 'r': options.ramp = atoi(optarg); break;
+			case 't': options.think = atoi(optarg); break;
+			case 'T': options.timeout = atoi(optarg); break;
+			case 'c': options.chat = atoi(optarg); break;
+			case 'a': options.actions.push_back(optarg); break;
+			case 'A': options.act = atoi(optarg); break;
+			case 's': options.seed = strtoul(optarg, nullptr, 10); break;
+			case 'o': output = optarg; break;
+			default: usage(argv[0]); return(1);
+		}
+	}
+	if(options.port == 0) {
+		usage(argv[0]);
+		return(1);
+	}
+
+	// One descriptor per bot.
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	Swarm swarm { options };
+	std::vector<struct Level> levels;
+	for(unsigned int count : options.levels) {
+		fprintf(stderr, "%u bots...\n", count);
+		levels.push_back(swarm.run(count));
+		const struct Level& level = levels.back();
+		fprintf(stderr, "%u bots: %u connected, %u failed, %u disconnected, move p99 %lu us\n",
+			count, level.connected, level.failed, level.disconnected,
+			(unsigned long) (level.commands[COMMAND_MOVE].latency.getPercentile(99) / 1000));
+		sleep(1); // Let the server delete the previous bots.
+	}
+
+	std::string json = Swarm::report(options, levels);
+	if(output.empty()) {
+		fputs(json.c_str(), stdout);
+	} else {
+		std::ofstream file { output };
+		file << json;
+		if(not file) {
+			fprintf(stderr, "Unable to write %s\n", output.c_str());
+			return(1);
+		}
+	}
+	return(0);
+}
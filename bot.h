@@ -0,0 +1,104 @@
+#pragma once
+
+#include "metrics.h"
+
+#include <cstdint>
+#include <functional> // std::greater
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define BOT_THINK 200 // Milliseconds between the commands of a bot, on average.
+#define BOT_TIMEOUT 1000 // Milliseconds without answer before a command is lost.
+#define BOT_RAMP 200 // Connections opened per second.
+#define BOT_INPUT_SIZE 4096 // Longest line read from the server.
+#define BOT_EPOLL_EVENTS 256
+
+// Commands whose round trip is measured. Each is followed by "ping <seq>":
+// the server answers lines in order, so "pong <seq>" comes after its effects.
+enum Command { COMMAND_CONNECT, COMMAND_MOVE, COMMAND_SAY, COMMAND_ACTION, COMMAND_COUNT };
+
+struct BotOptions {
+	std::string host = "127.0.0.1";
+	unsigned short port = 0;
+	std::vector<unsigned int> levels { 100 }; // Bots of each run.
+	unsigned int duration = 10; // Seconds measured per run, after the ramp.
+	unsigned int ramp = BOT_RAMP;
+	unsigned int think = BOT_THINK;
+	unsigned int timeout = BOT_TIMEOUT;
+	unsigned int chat = 10; // Percent of commands which are "say".
+	unsigned int act = 10; // Percent which are actions, if any.
+	std::vector<std::string> actions; // Sent as "/<action>".
+	std::uint32_t seed = 1;
+};
+
+struct Bot {
+	int fd = -1;
+	bool connected = false; // Its first ping was answered.
+	Command pending = COMMAND_CONNECT;
+	std::uint64_t seq = 0; // Of the pending command, 0 if none.
+	std::uint64_t sent_at = 0; // 0 until it connects.
+	bool measuring = false; // The pending command was sent past the ramp: it and its answers count.
+	std::uint64_t next_at = 0; // Its only valid entry in the schedule.
+	int direction = 0; // Of the walk.
+	std::minstd_rand random;
+	char input[BOT_INPUT_SIZE];
+	std::size_t input_length = 0;
+	std::string output;
+};
+
+struct CommandStats {
+	Histogram latency; // Nanoseconds.
+	std::uint64_t sent = 0;
+	std::uint64_t timeouts = 0;
+};
+
+// Results of a run, with a given number of bots.
+struct Level {
+	unsigned int bots = 0;
+	unsigned int connected = 0;
+	unsigned int failed = 0; // Connections refused, reset or unanswered.
+	unsigned int disconnected = 0; // By the server, once connected.
+	// Below, only for commands sent while measuring; connections always.
+	std::uint64_t lines = 0; // Received.
+	std::uint64_t bytes = 0;
+	std::uint64_t late = 0; // Answers after their timeout.
+	double seconds = 0; // Measured.
+	CommandStats commands[COMMAND_COUNT];
+};
+
+// Simulated players over loopback, driven by one epoll loop.
+class Swarm {
+public:
+	explicit Swarm(const BotOptions& options);
+	~Swarm();
+
+	struct Level run(unsigned int count);
+	static std::string report(const BotOptions& options, const std::vector<struct Level>& levels); // JSON.
+
+private:
+	const BotOptions& options;
+	int epoll_fd;
+	std::vector<struct Bot> bots;
+	// Next event of each bot, earliest first.
+	std::priority_queue<
+		std::pair<std::uint64_t, unsigned int>,
+		std::vector<std::pair<std::uint64_t, unsigned int>>,
+		std::greater<std::pair<std::uint64_t, unsigned int>>
+	> schedule;
+	struct Level level;
+	bool measuring = false; // Past the ramp: commands sent now count.
+	std::uint64_t last_seq = 0;
+
+	void at(unsigned int id, std::uint64_t time);
+	void wake(unsigned int id, std::uint64_t now);
+	void connect(unsigned int id, std::uint64_t now);
+	void command(unsigned int id, std::uint64_t now);
+	void receive(unsigned int id);
+	void parse(unsigned int id, const char * line, std::size_t length);
+	void send(unsigned int id, const std::string& message);
+	void flush(unsigned int id);
+	void drop(unsigned int id);
+};
@@ -7,6 +7,7 @@
 #include "luawrapper.h"
 #include "place.h"
 #include "log.h"
+#include "journal.h"
 
 // PUBLIC
 
@@ -37,7 +38,7 @@ Character::~Character() {
 		if(this->whenDeath != Script::noValue) {
 			Script script = this->whenDeath;
 			this->whenDeath = Script::noValue;
-			script.execute(*(this->zone->getServer()->getLua()), this);
+			script.execute(*(this->zone->getLua()), this, "", TRIGGER_DEATH);
 		}
 		this->zone->exitCharacter(this);
 		this->zone->getServer()->remCharacter(id);
@@ -45,6 +46,9 @@ Character::~Character() {
 	for(auto it : this->gauges) {
 		delete(it.second);
 	}
+	for(auto& it : this->waiting_move) {
+		it.first->release(it.second);
+	}
 }
 
 Uuid Character::getId() {
@@ -74,10 +78,19 @@ unsigned int Character::getY() {
 }
 
 void Character::setXY(int x, int y) {
+	int old_x = this->x;
+	int old_y = this->y;
 	this->x = x;
 	this->y = y;
 	if(this->zone) {
-		this->zone->updateCharacter(this);
+		this->zone->moveCharacter(this, old_x, old_y);
+	}
+	if(this->zone and not this->waiting_move.empty()) {
+		// Resumed once the move is over: they may move or delete this character.
+		for(auto& it : this->waiting_move) {
+			this->zone->getServer()->resumeLater(it.first, it.second);
+		}
+		this->waiting_move.clear();
 	}
 }
 
@@ -90,8 +103,8 @@ void Character::move(int xShift, int yShift) {
 			this->setXY(new_x, new_y);
 
 			// Trigger landon script.
-			class Place * place = this->zone->getPlace(new_x, new_y);
-			place->getWhenWalkedOn().execute(*(this->zone->getServer()->getLua()), this);
+			class Place place = this->zone->getPlace(new_x, new_y);
+			place.getWhenWalkedOn().execute(*(this->zone->getLua()), this, "", TRIGGER_LANDON);
 		}
 	}
 }
@@ -102,6 +115,12 @@ void Character::changeZone(class Zone * newZone, int x, int y) {
 	}
 	this->zone = newZone;
 	this->zone->enterCharacter(this, x, y);
+	class Journal * journal = this->zone->getServer()->getJournal();
+	if(journal) journal->changeZone(this->id, this->zone->getId(), x, y);
+}
+
+class Player * Character::getPlayer() {
+	return(this->player);
 }
 
 void Character::setPlayer(class Player * player) {
@@ -116,6 +135,10 @@ void Character::setWhenDeath(const Script& script) {
 	this->whenDeath = script;
 }
 
+void Character::waitMove(class Luawrapper * lua, int thread) {
+	this->waiting_move.emplace_back(lua, thread);
+}
+
 class Gauge * Character::getGauge(const Name& name) {
 	try {
 		return(this->gauges.at(name.toString()));
@@ -124,6 +147,10 @@ class Gauge * Character::getGauge(const Name& name) {
 	}
 }
 
+const std::map<std::string, class Gauge *>& Character::getGauges() {
+	return(this->gauges);
+}
+
 void Character::addGauge(class Gauge * gauge) {
 	class Gauge * old = this->getGauge(gauge->getName());
 	if(old) {
@@ -226,6 +253,18 @@ void Character::updateFloor(unsigned int x, unsigned int y, const Aspect& aspect
 	}
 }
 
+void Character::updateFloorRegion(unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+	if(this->player) {
+		this->player->updateFloorRegion(x, y, w, h);
+	}
+}
+
+void Character::clearFloor() {
+	if(this->player) {
+		this->player->clearFloor();
+	}
+}
+
 void Character::updateGauge(
 	std::string name,
 	unsigned int val,
@@ -255,3 +294,18 @@ void Character::hint(Aspect aspect, std::string hint) {
 		this->player->hint(aspect, hint);
 	}
 }
+
+// PROTECTED
+
+void Character::tagChanged(const TagID& id, const TagValue * value) {
+	// Out of any zone, as when restored: not journaled.
+	class Journal * journal = this->zone ? this->zone->getServer()->getJournal() : nullptr;
+	if(journal == nullptr) {
+		return;
+	}
+	if(value) {
+		journal->setCharacterTag(this->id, id, *value);
+	} else {
+		journal->delCharacterTag(this->id, id);
+	}
+}
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <utility>
 
 #include "aspect.h"
 #include "name.h"
@@ -12,6 +14,7 @@
 class Player;
 class Zone;
 class Gauge;
+class Luawrapper;
 
 // TODO : Invisible.
 // TODO : Unmovable.
@@ -27,13 +30,16 @@ public:
 	void setXY(int x, int y); // dont check if canLand(); auto bcast new position.
 	void move(int xShift, int yShift); // check if canLand() and setXY() if yes.
 	void changeZone(class Zone * newZone, int x, int y); // exit this zone, enter the new one.
+	class Player * getPlayer(); // May return nullptr.
 	void setPlayer(class Player * player);
 
 	/* Scripts */
 	const Script& getWhenDeath();
 	void setWhenDeath(const Script& script);
+	void waitMove(class Luawrapper * lua, int thread); // Resume the coroutine at the next move.
 
 	class Gauge * getGauge(const Name& name); // May return nullptr.
+	const std::map<std::string, class Gauge *>& getGauges();
 	void addGauge(class Gauge * gauge); // Only a new gauge can call it.
 	void delGauge(const Name& name);
 
@@ -58,6 +64,8 @@ public:
 	void updateCharacterExit(class Character * character);
 	void updateFloor();
 	void updateFloor(unsigned int x, unsigned int y, const Aspect& aspect);
+	void updateFloorRegion(unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+	void clearFloor();
 	void updateGauge(
 		std::string name,
 		unsigned int val,
@@ -74,6 +82,9 @@ public:
 	void follow(class Character * character);
 	void hint(Aspect aspect, std::string hint);
 
+protected:
+	void tagChanged(const TagID& id, const TagValue * value) override; // Journaled.
+
 private:
 	class Player* player; // May be nullptr.
 
@@ -84,6 +95,7 @@ private:
 	Script whenDeath;
 	std::map<std::string, class Gauge *> gauges;
 	bool ghost;
+	std::vector<std::pair<class Luawrapper *, int>> waiting_move; // Coroutines.
 /*
 	unsigned int movepoints;
 	bool visible;
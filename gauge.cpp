@@ -3,6 +3,9 @@
 #include "zone.h"
 #include "server.h"
 #include "luawrapper.h"
+#include "journal.h"
+
+#include <algorithm> // std::min()
 
 Gauge::Gauge(
 	class Character * character,
@@ -38,6 +41,11 @@ unsigned int Gauge::getVal() {
 }
 
 void Gauge::setVal(unsigned int val) {
+	// Journaled before the scripts, whose own changes come after.
+	class Zone * zone = this->character->getZone();
+	if(zone != nullptr and zone->getServer()->getJournal()) {
+		zone->getServer()->getJournal()->setGaugeVal(this->character->getId(), this->getName(), std::min(val, this->max));
+	}
 	if(val >= this->max) {
 		this->val = this->max;
 		this->exeFull();
@@ -50,6 +58,11 @@ void Gauge::setVal(unsigned int val) {
 	this->update();
 }
 
+void Gauge::restoreVal(unsigned int val) {
+	this->val = std::min(val, this->max);
+	this->update();
+}
+
 void Gauge::increase(unsigned int val) {
 	unsigned int new_val = this->val+val;
 	this->setVal(new_val);
@@ -82,6 +95,14 @@ void Gauge::setMax(unsigned int max) {
 	this->update();
 }
 
+const Aspect& Gauge::getAspectFull() {
+	return(this->aFull);
+}
+
+const Aspect& Gauge::getAspectEmpty() {
+	return(this->aEmpty);
+}
+
 const Script& Gauge::getWhenFull() {
 	return(this->whenFull);
 }
@@ -145,7 +166,7 @@ void Gauge::exeFull() {
 	if(this->whenFull != Script::noValue) {
 		class Zone * zone = this->character->getZone();
 		if(zone != nullptr) {
-			this->whenFull.execute(*(zone->getServer()->getLua()), this->character);
+			this->whenFull.execute(*(zone->getLua()), this->character, "", TRIGGER_GAUGE);
 		}
 	}
 }
@@ -154,7 +175,7 @@ void Gauge::exeEmpty() {
 	if(this->whenEmpty != Script::noValue) {
 		class Zone * zone = this->character->getZone();
 		if(zone != nullptr) {
-			this->whenEmpty.execute(*(zone->getServer()->getLua()), this->character);
+			this->whenEmpty.execute(*(zone->getLua()), this->character, "", TRIGGER_GAUGE);
 		}
 	}
 }
@@ -22,10 +22,13 @@ public:
 	~Gauge();
 	unsigned int getVal();
 	void setVal(unsigned int val);
+	void restoreVal(unsigned int val); // No script: replaying the journal.
 	void increase(unsigned int val);
 	void decrease(unsigned int val);
 	unsigned int getMax();
 	void setMax(unsigned int max);
+	const Aspect& getAspectFull();
+	const Aspect& getAspectEmpty();
 
 	/* Scripts */
 	const Script& getWhenFull();
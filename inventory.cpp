@@ -1,7 +1,43 @@
 #include "inventory.h"
 
-#include <algorithm> // min()
-#include <numeric> // accumulate()
+#include "server.h"
+#include "journal.h"
+
+#include <algorithm> // min(), sort()
+
+/* Item table */
+
+std::vector<std::string> itemTable; // Global
+std::unordered_map<std::string, std::uint32_t> itemIds; // Global
+
+ItemID::ItemID(const std::string& name) {
+	// Intern.
+	auto it = itemIds.find(name);
+	if(it != itemIds.end()) {
+		this->id = it->second;
+	} else {
+		this->id = itemTable.size();
+		itemIds.emplace(name, this->id);
+		itemTable.push_back(name);
+	}
+}
+
+ItemID ItemID::find(const std::string& name) {
+	auto it = itemIds.find(name);
+	return(it != itemIds.end() ? ItemID{it->second} : ItemID::none);
+}
+
+const ItemID ItemID::none { UINT32_MAX };
+
+const std::string& ItemID::toString() const {
+	return(itemTable[this->id]);
+}
+
+std::uint32_t ItemID::toId() const {
+	return(this->id);
+}
+
+/* Inventory */
 
 Inventory::Inventory(unsigned int size) :
 	_size(size)
@@ -9,19 +45,32 @@ Inventory::Inventory(unsigned int size) :
 
 Inventory::~Inventory() {}
 
-unsigned int Inventory::get(std::string name) {
-	try {
-		return(content.at(name));
-	} catch(...) {
-		return(0);
-	}
+void Inventory::attach(class Server * server, Uuid id) {
+	this->server = server;
+	this->id = id;
+}
+
+unsigned int Inventory::get(const std::string& name) {
+	return(this->get(ItemID::find(name)));
+}
+
+unsigned int Inventory::get(ItemID item) {
+	unsigned int * quantity = this->find(item);
+	return(quantity ? *quantity : 0);
 }
 
 std::vector<std::string> Inventory::get_all() {
 	std::vector<std::string> keys;
-	for(auto& it: this->content) {
-		keys.push_back(it.first);
+	if(this->table) {
+		for(auto& it : *this->table) {
+			keys.push_back(itemTable[it.first]);
+		}
+	} else {
+		for(unsigned int i = 0; i < this->used; i++) {
+			keys.push_back(itemTable[this->slots[i].item]);
+		}
 	}
+	std::sort(keys.begin(), keys.end());
 	return(keys);
 }
 
@@ -31,78 +80,146 @@ unsigned int Inventory::size() {
 
 void Inventory::resize(unsigned int size) {
 	this->_size = size;
+	class Journal * journal = this->getJournal();
+	if(journal) journal->resizeInventory(this->id, size);
 }
 
 unsigned int Inventory::available() {
-	unsigned int total = std::accumulate(content.begin(), content.end(), 0,
-		[] (int val, const std::map<std::string, unsigned int>::value_type& i) {
-			return(val + i.second);
-		}
-	);
-	if(total >= this->_size) {
+	if(this->total >= this->_size) {
 		return(0);
 	} else {
-		return(this->_size - total);
+		return(this->_size - this->total);
 	}
 }
 
-unsigned int Inventory::add(unsigned int quantity, std::string name) {
+unsigned int Inventory::add(unsigned int quantity, const std::string& name) {
 	unsigned int to_add = std::min(quantity, available());
-	content[name] += to_add;
+	this->put(ItemID{name}, to_add);
+	class Journal * journal = this->getJournal();
+	if(journal and to_add > 0) journal->addInventory(this->id, name, to_add);
 	return(to_add);
 }
 
-unsigned int Inventory::del(unsigned int quantity, std::string name) {
-	unsigned int to_del = std::min(quantity, get(name));
-	content[name] -= to_del;
-	clean(name);
+unsigned int Inventory::del(unsigned int quantity, const std::string& name) {
+	ItemID item = ItemID::find(name); // Unknown: none to take.
+	unsigned int to_del = std::min(quantity, get(item));
+	this->take(item, to_del);
+	class Journal * journal = this->getJournal();
+	if(journal and to_del > 0) journal->delInventoryItem(this->id, name, to_del);
 	return(to_del);
 }
 
-unsigned int Inventory::move(unsigned int quantity, std::string name, Inventory& destination) {
-	unsigned int to_move = std::min({ quantity, get(name), destination.available() });
-	content[name] -= to_move;
-	destination.content[name] += to_move;
-	clean(name);
+unsigned int Inventory::move(unsigned int quantity, const std::string& name, Inventory& destination) {
+	ItemID item = ItemID::find(name);
+	unsigned int to_move = std::min({ quantity, get(item), destination.available() });
+	this->take(item, to_move);
+	destination.put(item, to_move);
+	class Journal * journal = this->getJournal();
+	if(journal and to_move > 0) journal->moveInventoryItem(this->id, name, to_move, destination.id);
 	return(to_move);
 }
 
-unsigned int Inventory::add_all(unsigned int quantity, std::string name) {
+unsigned int Inventory::add_all(unsigned int quantity, const std::string& name) {
 	if(quantity > available()) {
 		return(0);
 	} else {
-		content[name] += quantity;
+		this->put(ItemID{name}, quantity);
+		class Journal * journal = this->getJournal();
+		if(journal and quantity > 0) journal->addInventory(this->id, name, quantity);
 		return(quantity);
 	}
 }
 
-unsigned int Inventory::del_all(unsigned int quantity, std::string name) {
-	if(quantity < get(name)) {
+unsigned int Inventory::del_all(unsigned int quantity, const std::string& name) {
+	ItemID item = ItemID::find(name);
+	if(quantity > get(item)) { // Not enough of it.
 		return(0);
 	} else {
-		content[name] -= quantity;
-		clean(name);
+		this->take(item, quantity);
+		class Journal * journal = this->getJournal();
+		if(journal and quantity > 0) journal->delInventoryItem(this->id, name, quantity);
 		return(quantity);
 	}
 }
 
-unsigned int Inventory::move_all(unsigned int quantity, std::string name, Inventory& destination) {
-	if(quantity < get(name)) {
+unsigned int Inventory::move_all(unsigned int quantity, const std::string& name, Inventory& destination) {
+	ItemID item = ItemID::find(name);
+	if(quantity > get(item)) { // Not enough of it.
 		return(0);
 	}
 	if(quantity > destination.available()) {
 		return(0);
 	}
-	content[name] -= quantity;
-	destination.content[name] += quantity;
-	clean(name);
+	this->take(item, quantity);
+	destination.put(item, quantity);
+	class Journal * journal = this->getJournal();
+	if(journal and quantity > 0) journal->moveInventoryItem(this->id, name, quantity, destination.id);
 	return(quantity);
 }
 
 // Private
 
-void Inventory::clean(std::string s) {
-	if(content[s] <= 0) {
-		content.erase(s);
+unsigned int * Inventory::find(ItemID item) {
+	if(this->table) {
+		auto it = this->table->find(item.toId());
+		return(it != this->table->end() ? &it->second : nullptr);
+	}
+	for(unsigned int i = 0; i < this->used; i++) {
+		if(this->slots[i].item == item.toId()) {
+			return(&this->slots[i].quantity);
+		}
+	}
+	return(nullptr);
+}
+
+void Inventory::put(ItemID item, unsigned int quantity) {
+	if(quantity == 0) {
+		return;
+	}
+	this->total += quantity;
+	unsigned int * current = this->find(item);
+	if(current) {
+		*current += quantity;
+	} else if(this->table) {
+		this->table->emplace(item.toId(), quantity);
+	} else if(this->used < INVENTORY_INLINE) {
+		this->slots[this->used++] = { item.toId(), quantity };
+	} else {
+		// Spill the slots into the table, for good.
+		this->table.reset(new std::unordered_map<std::uint32_t, unsigned int>());
+		for(unsigned int i = 0; i < this->used; i++) {
+			this->table->emplace(this->slots[i].item, this->slots[i].quantity);
+		}
+		this->used = 0;
+		this->table->emplace(item.toId(), quantity);
 	}
 }
+
+void Inventory::take(ItemID item, unsigned int quantity) {
+	unsigned int * current = this->find(item);
+	if(current == nullptr or quantity == 0) {
+		return;
+	}
+	quantity = std::min(quantity, *current);
+	this->total -= quantity;
+	*current -= quantity;
+	if(*current > 0) {
+		return;
+	}
+
+	// Empty: forget the item.
+	if(this->table) {
+		this->table->erase(item.toId());
+	} else {
+		for(unsigned int i = 0; i < this->used; i++) {
+			if(this->slots[i].item == item.toId()) {
+				this->slots[i] = this->slots[--this->used];
+				break;
+			}
+		}
+	}
+}
+
+class Journal * Inventory::getJournal() {
+	return(this->server ? this->server->getJournal() : nullptr);
+}
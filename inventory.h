@@ -1,33 +1,74 @@
 #pragma once
 
+class Server;
+class Journal;
+
+#include "uuid.h"
+
 #include <string>
-#include <map>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
+#define INVENTORY_INLINE 6 // Kinds of items stored in the inventory itself; more go to a hash table.
+
+// Handle into a global table of item names: comparisons and hashes are integer ones.
+class ItemID {
+public:
+	explicit ItemID(const std::string& name); // Interned: for items being stored.
+	static ItemID find(const std::string& name); // ItemID::none if never interned.
+	static const ItemID none; // Held by no inventory.
+	bool operator == (const ItemID& rhs) const { return(this->id == rhs.id); }
+	bool operator != (const ItemID& rhs) const { return(this->id != rhs.id); }
+	const std::string& toString() const;
+	std::uint32_t toId() const;
+
+private:
+	std::uint32_t id; // In the item table.
+
+	explicit ItemID(std::uint32_t id) : id(id) { }
+};
+
 class Inventory {
 public:
 	Inventory(unsigned int size);
 	~Inventory();
 
-	unsigned int get(std::string name);
-	std::vector<std::string> get_all();
+	// Journal the changes under this id: done by the server for its inventories.
+	void attach(class Server * server, Uuid id);
+
+	unsigned int get(const std::string& name);
+	unsigned int get(ItemID item);
+	std::vector<std::string> get_all(); // Sorted by name.
 	unsigned int size();
 	void resize(unsigned int size); // Do not destroy items.
 	unsigned int available();
 
-	unsigned int add(unsigned int quantity, std::string name);
-	unsigned int del(unsigned int quantity, std::string name);
-	unsigned int move(unsigned int quantity, std::string name, Inventory& destination);
+	unsigned int add(unsigned int quantity, const std::string& name);
+	unsigned int del(unsigned int quantity, const std::string& name);
+	unsigned int move(unsigned int quantity, const std::string& name, Inventory& destination);
 
-	unsigned int add_all(unsigned int quantity, std::string name);
-	unsigned int del_all(unsigned int quantity, std::string name);
-	unsigned int move_all(unsigned int quantity, std::string name, Inventory& destination);
+	unsigned int add_all(unsigned int quantity, const std::string& name);
+	unsigned int del_all(unsigned int quantity, const std::string& name);
+	unsigned int move_all(unsigned int quantity, const std::string& name, Inventory& destination);
 	// The *_all methods return either 0 or 'quantity', and cancel the operation entirely if it cannot be fully carried out.
 
 	// TODO: bool recipe(requierd[], produced[]);
 private:
+	class Server * server = nullptr; // Not journaled while nullptr.
+	Uuid id = Uuid::fromInteger(0);
 	unsigned int _size;
-	std::map<std::string, unsigned int> content;
+	unsigned int total = 0; // Of all quantities.
+
+	// Small inventories: unsorted slots, scanned. Larger ones: the table.
+	struct Slot { std::uint32_t item; unsigned int quantity; };
+	struct Slot slots[INVENTORY_INLINE];
+	unsigned int used = 0;
+	std::unique_ptr<std::unordered_map<std::uint32_t, unsigned int>> table;
 
-	void clean(std::string s);
+	unsigned int * find(ItemID item);
+	void put(ItemID item, unsigned int quantity);
+	void take(ItemID item, unsigned int quantity); // At most what there is.
+	class Journal * getJournal(); // May return nullptr.
 };
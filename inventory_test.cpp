@@ -0,0 +1,43 @@
+#include "inventory.h"
+#include "log.h"
+
+#include <cstdio> // printf()
+#include <string>
+
+// The *_all methods carry out the whole quantity, or nothing.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+	if(not ok) {
+		printf("FAIL: %s\n", what.c_str());
+		failures++;
+	}
+}
+
+int main() {
+	setNoVerbose();
+
+	Inventory bag { 10 };
+	check(bag.add_all(11, "gold") == 0 and bag.get("gold") == 0, "add_all over the size");
+	check(bag.add_all(5, "gold") == 5 and bag.get("gold") == 5, "add_all");
+
+	// Less than the stack: taken.
+	check(bag.del_all(3, "gold") == 3 and bag.get("gold") == 2, "del_all of part of the stack");
+	// More than the stack: nothing.
+	check(bag.del_all(3, "gold") == 0 and bag.get("gold") == 2, "del_all of more than the stack");
+	check(bag.del_all(2, "gold") == 2 and bag.get("gold") == 0, "del_all of the whole stack");
+	check(bag.del_all(1, "silver") == 0, "del_all of an unknown item");
+
+	Inventory chest { 4 };
+	bag.add(6, "gold");
+	check(bag.move_all(2, "gold", chest) == 2 and bag.get("gold") == 4 and chest.get("gold") == 2, "move_all of part of the stack");
+	check(bag.move_all(5, "gold", chest) == 0 and bag.get("gold") == 4 and chest.get("gold") == 2, "move_all of more than the stack");
+	check(bag.move_all(3, "gold", chest) == 0 and bag.get("gold") == 4 and chest.get("gold") == 2, "move_all to a full destination");
+	check(bag.move_all(2, "gold", chest) == 2 and bag.get("gold") == 2 and chest.get("gold") == 4, "move_all filling the destination");
+
+	if(failures == 0) {
+		printf("OK\n");
+	}
+	return(failures == 0 ? 0 : 1);
+}
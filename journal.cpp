@@ -0,0 +1,374 @@
+#include "journal.h"
+
+#include "server.h"
+#include "zone.h"
+#include "place.h"
+#include "character.h"
+#include "gauge.h"
+#include "inventory.h"
+#include "artifact.h"
+#include "log.h"
+
+#include <unistd.h> // write(), fsync(), ftruncate()
+#include <fcntl.h> // open()
+#include <cstdio> // rename()
+#include <cerrno>
+#include <ctime> // clock_gettime()
+
+/* Record: sequence 64, type 8, then its fields (see the writers).
+ * Strings are a length 32 then bytes, ids are 64 bits. */
+
+enum JournalRecord : std::uint8_t {
+	NEW_ARTIFACT = 1,
+	DEL_ARTIFACT,
+	NEW_INVENTORY,
+	DEL_INVENTORY,
+	RESIZE_INVENTORY,
+	ADD_INVENTORY,
+	DEL_INVENTORY_ITEM,
+	MOVE_INVENTORY_ITEM,
+	SET_CHARACTER_TAG,
+	DEL_CHARACTER_TAG,
+	SET_ARTIFACT_TAG,
+	DEL_ARTIFACT_TAG,
+	SET_PLACE_TAG,
+	DEL_PLACE_TAG,
+	SET_GAUGE_VAL,
+	CHANGE_ZONE,
+};
+
+static std::uint64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000ull + ts.tv_nsec / 1000000);
+}
+
+Journal::Journal(const std::string& filename, unsigned int sync_interval, std::uint64_t sequence) :
+	filename(filename),
+	sync_interval(sync_interval),
+	sequence(sequence),
+	last_sync(now())
+{
+	this->fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if(this->fd == -1) {
+		warning("Unable to open journal '"+filename+"'.");
+	}
+}
+
+Journal::~Journal() {
+	this->commit();
+	this->sync();
+	if(this->fd != -1) {
+		close(this->fd);
+	}
+}
+
+bool Journal::isOpen() {
+	return(this->fd != -1);
+}
+
+std::uint64_t Journal::getSequence() {
+	return(this->sequence);
+}
+
+/* Records */
+
+void Journal::newArtifact(Uuid id, const Name& name) {
+	BinaryWriter& r = this->record(NEW_ARTIFACT);
+	r.put64(id.toInteger());
+	r.putString(name.toString());
+}
+
+void Journal::delArtifact(Uuid id) {
+	this->record(DEL_ARTIFACT).put64(id.toInteger());
+}
+
+void Journal::newInventory(Uuid id, unsigned int size) {
+	BinaryWriter& r = this->record(NEW_INVENTORY);
+	r.put64(id.toInteger());
+	r.put32(size);
+}
+
+void Journal::delInventory(Uuid id) {
+	this->record(DEL_INVENTORY).put64(id.toInteger());
+}
+
+void Journal::resizeInventory(Uuid id, unsigned int size) {
+	BinaryWriter& r = this->record(RESIZE_INVENTORY);
+	r.put64(id.toInteger());
+	r.put32(size);
+}
+
+void Journal::addInventory(Uuid id, const std::string& item, unsigned int quantity) {
+	BinaryWriter& r = this->record(ADD_INVENTORY);
+	r.put64(id.toInteger());
+	r.putString(item);
+	r.put32(quantity);
+}
+
+void Journal::delInventoryItem(Uuid id, const std::string& item, unsigned int quantity) {
+	BinaryWriter& r = this->record(DEL_INVENTORY_ITEM);
+	r.put64(id.toInteger());
+	r.putString(item);
+	r.put32(quantity);
+}
+
+void Journal::moveInventoryItem(Uuid id, const std::string& item, unsigned int quantity, Uuid destination) {
+	BinaryWriter& r = this->record(MOVE_INVENTORY_ITEM);
+	r.put64(id.toInteger());
+	r.putString(item);
+	r.put32(quantity);
+	r.put64(destination.toInteger());
+}
+
+void Journal::setCharacterTag(Uuid id, const TagID& tag, const TagValue& value) {
+	BinaryWriter& r = this->record(SET_CHARACTER_TAG);
+	r.put64(id.toInteger());
+	r.putString(tag.toString());
+	r.putString(value.toString());
+}
+
+void Journal::delCharacterTag(Uuid id, const TagID& tag) {
+	BinaryWriter& r = this->record(DEL_CHARACTER_TAG);
+	r.put64(id.toInteger());
+	r.putString(tag.toString());
+}
+
+void Journal::setArtifactTag(Uuid id, const TagID& tag, const TagValue& value) {
+	BinaryWriter& r = this->record(SET_ARTIFACT_TAG);
+	r.put64(id.toInteger());
+	r.putString(tag.toString());
+	r.putString(value.toString());
+}
+
+void Journal::delArtifactTag(Uuid id, const TagID& tag) {
+	BinaryWriter& r = this->record(DEL_ARTIFACT_TAG);
+	r.put64(id.toInteger());
+	r.putString(tag.toString());
+}
+
+void Journal::setPlaceTag(const std::string& zone, int x, int y, const TagID& tag, const TagValue& value) {
+	BinaryWriter& r = this->record(SET_PLACE_TAG);
+	r.putString(zone);
+	r.put32(x);
+	r.put32(y);
+	r.putString(tag.toString());
+	r.putString(value.toString());
+}
+
+void Journal::delPlaceTag(const std::string& zone, int x, int y, const TagID& tag) {
+	BinaryWriter& r = this->record(DEL_PLACE_TAG);
+	r.putString(zone);
+	r.put32(x);
+	r.put32(y);
+	r.putString(tag.toString());
+}
+
+void Journal::setGaugeVal(Uuid character, const Name& gauge, unsigned int val) {
+	BinaryWriter& r = this->record(SET_GAUGE_VAL);
+	r.put64(character.toInteger());
+	r.putString(gauge.toString());
+	r.put32(val);
+}
+
+void Journal::changeZone(Uuid character, const std::string& zone, int x, int y) {
+	BinaryWriter& r = this->record(CHANGE_ZONE);
+	r.put64(character.toInteger());
+	r.putString(zone);
+	r.put32(x);
+	r.put32(y);
+}
+
+/* Files */
+
+void Journal::commit() {
+	const std::string& data = this->pending.getData();
+	if(this->fd != -1 and not data.empty()) {
+		// One write() for the whole batch: a crash may only tear the last record.
+		std::size_t done = 0;
+		while(done < data.length()) {
+			ssize_t written = write(this->fd, data.data() + done, data.length() - done);
+			if(written == -1) {
+				if(errno == EINTR) {
+					continue;
+				}
+				warning("Unable to write journal '"+this->filename+"'.");
+				break;
+			}
+			done += written;
+		}
+		this->unsynced = true;
+	}
+	this->pending.clear();
+
+	if(this->unsynced and now() - this->last_sync >= this->sync_interval) {
+		this->sync();
+	}
+}
+
+int Journal::getSyncDelay() {
+	if(not this->unsynced) {
+		return(-1);
+	}
+	std::uint64_t elapsed = now() - this->last_sync;
+	return(elapsed >= this->sync_interval ? 0 : this->sync_interval - elapsed);
+}
+
+void Journal::sync() {
+	if(this->fd != -1 and this->unsynced) {
+		fdatasync(this->fd);
+	}
+	this->unsynced = false;
+	this->last_sync = now();
+}
+
+void Journal::rotate() {
+	std::string old = this->filename + JOURNAL_OLD_SUFFIX;
+	if(this->fd == -1 or access(old.c_str(), F_OK) == 0) {
+		return;
+	}
+	this->commit();
+	this->sync();
+	close(this->fd);
+	if(rename(this->filename.c_str(), old.c_str()) == -1) {
+		warning("Unable to rename journal '"+this->filename+"'.");
+	}
+	this->fd = open(this->filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if(this->fd == -1) {
+		warning("Unable to open journal '"+this->filename+"'.");
+	}
+}
+
+void Journal::dropOld() {
+	unlink((this->filename + JOURNAL_OLD_SUFFIX).c_str());
+}
+
+BinaryWriter& Journal::record(std::uint8_t type) {
+	this->pending.put64(++this->sequence);
+	this->pending.put8(type);
+	return(this->pending);
+}
+
+/* Replay */
+
+static std::uint64_t replayFile(class Server * server, const std::string& filename, std::uint64_t after, bool cut) {
+	BinaryReader file { filename };
+	std::uint64_t sequence = after;
+	std::size_t valid = 0; // Bytes of complete records.
+	while(file.isOpen() and file.getRemaining() > 0) {
+		std::uint64_t record = file.get64();
+		std::uint8_t type = file.get8();
+
+		// Read the fields first: a torn record must change nothing.
+		Uuid id = Uuid::fromInteger(0);
+		Uuid other = Uuid::fromInteger(0);
+		std::string zone, text, value;
+		std::uint32_t x = 0, y = 0, number = 0;
+		bool known = true;
+		switch(type) {
+			case NEW_ARTIFACT: id = Uuid::fromInteger(file.get64()); text = file.getString(); break;
+			case DEL_ARTIFACT: case DEL_INVENTORY: id = Uuid::fromInteger(file.get64()); break;
+			case NEW_INVENTORY: case RESIZE_INVENTORY: id = Uuid::fromInteger(file.get64()); number = file.get32(); break;
+			case ADD_INVENTORY: case DEL_INVENTORY_ITEM:
+				id = Uuid::fromInteger(file.get64()); text = file.getString(); number = file.get32(); break;
+			case MOVE_INVENTORY_ITEM:
+				id = Uuid::fromInteger(file.get64()); text = file.getString(); number = file.get32();
+				other = Uuid::fromInteger(file.get64()); break;
+			case SET_CHARACTER_TAG: case SET_ARTIFACT_TAG:
+				id = Uuid::fromInteger(file.get64()); text = file.getString(); value = file.getString(); break;
+			case DEL_CHARACTER_TAG: case DEL_ARTIFACT_TAG: id = Uuid::fromInteger(file.get64()); text = file.getString(); break;
+			case SET_PLACE_TAG:
+				zone = file.getString(); x = file.get32(); y = file.get32(); text = file.getString(); value = file.getString(); break;
+			case DEL_PLACE_TAG: zone = file.getString(); x = file.get32(); y = file.get32(); text = file.getString(); break;
+			case SET_GAUGE_VAL: id = Uuid::fromInteger(file.get64()); text = file.getString(); number = file.get32(); break;
+			case CHANGE_ZONE: id = Uuid::fromInteger(file.get64()); zone = file.getString(); x = file.get32(); y = file.get32(); break;
+			default:
+				known = false;
+		}
+		if(not known) {
+			warning("Journal '"+filename+"' has an unknown record: stopped there.");
+			break;
+		}
+		if(not file.isValid()) {
+			break;
+		}
+		valid = file.getSize() - file.getRemaining();
+		if(record <= sequence) {
+			continue; // Already in the snapshot.
+		}
+		sequence = record;
+
+		class Character * character = nullptr;
+		class Artifact * artifact = nullptr;
+		class Inventory * inventory = nullptr;
+		class Zone * z = nullptr;
+		switch(type) {
+			case NEW_ARTIFACT:
+				server->addArtifact(id, new Artifact(Name { text }));
+				break;
+			case DEL_ARTIFACT:
+				server->delArtifact(id);
+				break;
+			case NEW_INVENTORY:
+				server->addInventory(id, new Inventory(number));
+				break;
+			case DEL_INVENTORY:
+				server->delInventory(id);
+				break;
+			case RESIZE_INVENTORY:
+				if((inventory = server->getInventory(id))) inventory->resize(number);
+				break;
+			case ADD_INVENTORY:
+				if((inventory = server->getInventory(id))) inventory->add(number, text);
+				break;
+			case DEL_INVENTORY_ITEM:
+				if((inventory = server->getInventory(id))) inventory->del(number, text);
+				break;
+			case MOVE_INVENTORY_ITEM: {
+				class Inventory * destination = server->getInventory(other);
+				if((inventory = server->getInventory(id)) and destination) inventory->move(number, text, *destination);
+				break;
+			}
+			case SET_CHARACTER_TAG:
+				if((character = server->getCharacter(id))) character->setTag(TagID { text }, TagValue { value });
+				break;
+			case DEL_CHARACTER_TAG:
+				if((character = server->getCharacter(id))) character->delTag(TagID { text });
+				break;
+			case SET_ARTIFACT_TAG:
+				if((artifact = server->getArtifact(id))) artifact->setTag(TagID { text }, TagValue { value });
+				break;
+			case DEL_ARTIFACT_TAG:
+				if((artifact = server->getArtifact(id))) artifact->delTag(TagID { text });
+				break;
+			case SET_PLACE_TAG:
+				if((z = server->getZone(zone)) and z->isPlaceValid(x, y)) z->getPlace(x, y).setTag(TagID { text }, TagValue { value });
+				break;
+			case DEL_PLACE_TAG:
+				if((z = server->getZone(zone)) and z->isPlaceValid(x, y)) z->getPlace(x, y).delTag(TagID { text });
+				break;
+			case SET_GAUGE_VAL:
+				if((character = server->getCharacter(id))) {
+					class Gauge * gauge = character->getGauge(Name { text });
+					if(gauge) gauge->restoreVal(number);
+				}
+				break;
+			case CHANGE_ZONE:
+				if((character = server->getCharacter(id)) and (z = server->getZone(zone))) character->changeZone(z, x, y);
+				break;
+		}
+	}
+
+	if(cut and file.isOpen() and not file.isValid()) {
+		warning("Journal '"+filename+"' ends with a torn record: cut off.");
+		if(truncate(filename.c_str(), valid) == -1) {
+			warning("Unable to cut journal '"+filename+"'.");
+		}
+	}
+	return(sequence);
+}
+
+std::uint64_t Journal::replay(class Server * server, const std::string& filename, std::uint64_t sequence) {
+	sequence = replayFile(server, filename + JOURNAL_OLD_SUFFIX, sequence, false);
+	return(replayFile(server, filename, sequence, true));
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+class Server;
+
+#include "binary.h"
+#include "name.h"
+#include "tag.h"
+#include "uuid.h"
+
+#include <cstdint>
+#include <string>
+
+#define JOURNAL_SYNC_INTERVAL 100 // Default milliseconds between two fsync().
+#define JOURNAL_OLD_SUFFIX ".old" // Journal older than the running snapshot.
+
+// Append-only log of the world mutations made since the last snapshot.
+// Records are buffered and written together by commit(), once per loop.
+class Journal {
+public:
+	// Append to the file; sequence is the last record already in it.
+	Journal(const std::string& filename, unsigned int sync_interval, std::uint64_t sequence);
+	~Journal(); // Commit and fsync().
+
+	Journal(Journal const &) = delete;
+	void operator=(Journal const &) = delete;
+
+	bool isOpen();
+	std::uint64_t getSequence(); // Of the last record.
+
+	/* Records */
+	void newArtifact(Uuid id, const Name& name);
+	void delArtifact(Uuid id);
+	void newInventory(Uuid id, unsigned int size);
+	void delInventory(Uuid id);
+	void resizeInventory(Uuid id, unsigned int size);
+	void addInventory(Uuid id, const std::string& item, unsigned int quantity);
+	void delInventoryItem(Uuid id, const std::string& item, unsigned int quantity);
+	void moveInventoryItem(Uuid id, const std::string& item, unsigned int quantity, Uuid destination);
+	void setCharacterTag(Uuid id, const TagID& tag, const TagValue& value);
+	void delCharacterTag(Uuid id, const TagID& tag);
+	void setArtifactTag(Uuid id, const TagID& tag, const TagValue& value);
+	void delArtifactTag(Uuid id, const TagID& tag);
+	void setPlaceTag(const std::string& zone, int x, int y, const TagID& tag, const TagValue& value);
+	void delPlaceTag(const std::string& zone, int x, int y, const TagID& tag);
+	void setGaugeVal(Uuid character, const Name& gauge, unsigned int val);
+	void changeZone(Uuid character, const std::string& zone, int x, int y);
+
+	// Write pending records, fsync() if the interval elapsed.
+	void commit();
+	// Milliseconds until commit() must run again to fsync(), -1 if nothing waits.
+	int getSyncDelay();
+	// Continue in a new file, the current one becomes "<file>.old" until the
+	// snapshot being written is done. Kept as is if there is an old one.
+	void rotate();
+	void dropOld(); // The snapshot is written.
+
+	// Apply the records newer than sequence, without journaling them.
+	// Return the last sequence found; the torn tail of a crash is cut off.
+	static std::uint64_t replay(class Server * server, const std::string& filename, std::uint64_t sequence);
+
+private:
+	std::string filename;
+	int fd;
+	unsigned int sync_interval;
+	std::uint64_t sequence;
+	BinaryWriter pending;
+	bool unsynced = false; // Written since the last fsync().
+	std::uint64_t last_sync; // Milliseconds, monotonic.
+
+	BinaryWriter& record(std::uint8_t type); // Start a record.
+	void sync();
+};
@@ -0,0 +1,157 @@
+#include "server.h"
+#include "zone.h"
+#include "place.h"
+#include "character.h"
+#include "gauge.h"
+#include "artifact.h"
+#include "inventory.h"
+#include "journal.h"
+#include "log.h"
+
+#include <stdlib.h> // mkdtemp()
+#include <unistd.h> // unlink(), rmdir(), truncate()
+#include <sys/stat.h> // stat()
+#include <sys/wait.h> // waitpid()
+#include <cstdio> // printf()
+#include <string>
+
+// The world survives a snapshot, the journal rotation, a restart, and a torn
+// last record.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+	if(not ok) {
+		printf("FAIL: %s\n", what.c_str());
+		failures++;
+	}
+}
+
+static std::string tagAt(class Server * server, int x, int y, const std::string& tag) {
+	class Zone * zone = server->getZone("test");
+	return(zone ? zone->getPlace(x, y).getTag(TagID{tag}).toString() : "");
+}
+
+static void setTag(class Server * server, int x, int y, const std::string& tag, const std::string& value) {
+	server->getZone("test")->getPlace(x, y).setTag(TagID{tag}, TagValue{value}); // Journaled by the place.
+}
+
+static class Server * start() {
+	class Server * server = new Server(false);
+	new Zone(server, "test", Name{"Test"}, 8, 8, Aspect{});
+	new Zone(server, "other", Name{"Other"}, 8, 8, Aspect{});
+	return(server);
+}
+
+static off_t fileSize(const std::string& filename) {
+	struct stat st;
+	return(stat(filename.c_str(), &st) == 0 ? st.st_size : -1);
+}
+
+int main() {
+	setNoVerbose();
+	char directory[] = "/tmp/journal_test.XXXXXX";
+	if(mkdtemp(directory) == nullptr) {
+		printf("FAIL: no temporary directory\n");
+		return(1);
+	}
+	std::string snapshot = std::string(directory)+"/world.snapshot";
+	std::string journal = std::string(directory)+"/world.journal";
+
+	// First run: changes before and after the snapshot.
+	class Server * server = start();
+	check(server->openJournal(journal, 0), "journal opened");
+	class Character * hero = new Character(Uuid{}, Name{"Hero"}, Aspect{});
+	Uuid hero_id = hero->getId();
+	server->addCharacter(hero);
+	hero->changeZone(server->getZone("test"), 0, 0);
+	new Gauge(hero, Name{"hp"}, 5, 10, Aspect{}, Aspect{}, false);
+	Uuid old_artifact = server->newArtifact(Name{"Old"});
+	Uuid bag = server->newInventory(10);
+	Uuid chest = server->newInventory(10);
+	setTag(server, 1, 2, "door", "open");
+	setTag(server, 3, 4, "trap", "armed");
+	server->getJournal()->commit();
+	check(server->saveSnapshot(snapshot), "snapshot started");
+	int status;
+	check(wait(&status) > 0 and WIFEXITED(status) and WEXITSTATUS(status) == 0, "snapshot written");
+	server->getJournal()->dropOld(); // As the loop does once the snapshot is written.
+
+	setTag(server, 5, 6, "chest", "looted");
+	hero->setTag(TagID{"quest"}, TagValue{"started"});
+	hero->getGauge(Name{"hp"})->setVal(7);
+	hero->changeZone(server->getZone("other"), 2, 3);
+	server->delArtifact(old_artifact);
+	Uuid new_artifact = server->newArtifact(Name{"New"});
+	server->getArtifact(new_artifact)->setTag(TagID{"owner"}, TagValue{"hero"});
+	server->getInventory(bag)->add(5, "gold");
+	server->getInventory(bag)->del(1, "gold");
+	server->getInventory(bag)->move(2, "gold", *server->getInventory(chest));
+	server->getJournal()->commit();
+	delete(server);
+
+	// Restart: the snapshot, then the journal since it.
+	server = start();
+	check(server->loadSnapshot(snapshot), "snapshot loaded");
+	check(tagAt(server, 1, 2, "door") == "open", "tag set before the snapshot");
+	check(tagAt(server, 3, 4, "trap") == "armed", "other tag set before the snapshot");
+	check(server->openJournal(journal, 0), "journal replayed");
+	check(tagAt(server, 5, 6, "chest") == "looted", "tag set after the snapshot");
+	hero = server->getCharacter(hero_id);
+	check(hero != nullptr, "character restored");
+	if(hero) {
+		check(hero->getTag(TagID{"quest"}).toString() == "started", "character tag");
+		check(hero->getGauge(Name{"hp"}) and hero->getGauge(Name{"hp"})->getVal() == 7, "gauge value");
+		check(hero->getZone() == server->getZone("other") and hero->getX() == 2 and hero->getY() == 3, "zone change");
+	}
+	check(server->getArtifact(old_artifact) == nullptr, "artifact deleted");
+	check(server->getArtifact(new_artifact) != nullptr, "artifact created");
+	if(server->getArtifact(new_artifact)) {
+		check(server->getArtifact(new_artifact)->getTag(TagID{"owner"}).toString() == "hero", "artifact tag");
+	}
+	check(server->getInventory(bag) and server->getInventory(bag)->get("gold") == 2, "inventory add and del");
+	check(server->getInventory(chest) and server->getInventory(chest)->get("gold") == 2, "inventory move");
+
+	// A crash in the middle of the last record.
+	off_t complete = fileSize(journal);
+	setTag(server, 7, 7, "torn", "yes");
+	server->getJournal()->commit();
+	delete(server);
+	check(fileSize(journal) > complete, "last record written");
+	check(truncate(journal.c_str(), fileSize(journal) - 3) == 0, "last record torn");
+
+	server = start();
+	check(server->loadSnapshot(snapshot), "snapshot loaded again");
+	check(server->openJournal(journal, 0), "torn journal replayed");
+	check(tagAt(server, 5, 6, "chest") == "looted", "records before the torn one");
+	check(tagAt(server, 7, 7, "torn").empty(), "torn record dropped");
+	check(fileSize(journal) == complete, "torn record cut off");
+	setTag(server, 0, 1, "after", "yes");
+	server->getJournal()->commit();
+	delete(server);
+
+	server = start();
+	check(server->loadSnapshot(snapshot), "snapshot loaded last");
+	check(server->openJournal(journal, 0), "journal replayed last");
+	check(tagAt(server, 0, 1, "after") == "yes", "record after the cut");
+	delete(server);
+
+	// An idle loop must still wake to fsync() the last batch.
+	{
+		Journal idle { journal, 60000, 0 };
+		check(idle.getSyncDelay() == -1, "nothing to sync");
+		idle.setPlaceTag("test", 0, 0, TagID{"idle"}, TagValue{"yes"});
+		idle.commit();
+		int delay = idle.getSyncDelay();
+		check(delay > 0 and delay <= 60000, "sync scheduled after a commit");
+	}
+
+	unlink(snapshot.c_str());
+	unlink(journal.c_str());
+	unlink((journal+JOURNAL_OLD_SUFFIX).c_str());
+	rmdir(directory);
+	if(failures == 0) {
+		printf("OK\n");
+	}
+	return(failures == 0 ? 0 : 1);
+}
@@ -1,33 +1,270 @@
 #include "log.h"
 
-#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib> // exit()
+#include <ctime> // clock_gettime(), gmtime_r()
+#include <map>
+#include <mutex>
+#include <thread>
 
-bool verbose = true;
+namespace {
+
+struct Entry {
+	LogLevel level;
+	struct timespec time;
+	std::string message;
+};
+
+// Bounded multi-producer queue: each slot's sequence tells whether it is
+// free for the producer of that position or ready for the consumer.
+struct Slot {
+	std::atomic<std::size_t> sequence;
+	Entry entry;
+};
+
+class Logger {
+public:
+	std::atomic<int> level { LOG_INFO };
+	std::atomic<int> format { LOG_PLAIN };
+
+	Logger() {
+		for(std::size_t i = 0; i < LOG_RING_SIZE; i++) {
+			this->slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		this->thread = std::thread(&Logger::drain, this);
+	}
+
+	~Logger() {
+		{
+			std::lock_guard<std::mutex> lock { this->mutex };
+			this->stop = true;
+		}
+		this->wake.notify_one();
+		this->thread.join();
+		if(this->file != stdout) {
+			fclose(this->file);
+		}
+	}
+
+	void push(LogLevel level, std::string&& message) {
+		Entry entry { level, {}, std::move(message) };
+		clock_gettime(CLOCK_REALTIME, &entry.time);
+
+		std::size_t position = this->head.load(std::memory_order_relaxed);
+		Slot * slot;
+		while(true) {
+			slot = &this->slots[position & (LOG_RING_SIZE - 1)];
+			std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			if(sequence == position) {
+				if(this->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if(sequence < position) {
+				this->dropped.fetch_add(1, std::memory_order_relaxed); // Full.
+				return;
+			} else {
+				position = this->head.load(std::memory_order_relaxed);
+			}
+		}
+		slot->entry = std::move(entry);
+		slot->sequence.store(position + 1, std::memory_order_release);
+		this->wake.notify_one();
+	}
+
+	bool open(const std::string& filename) {
+		FILE * file = filename.empty() ? stdout : fopen(filename.c_str(), "a");
+		if(file == nullptr) {
+			return(false);
+		}
+		std::lock_guard<std::mutex> lock { this->output };
+		if(this->file != stdout) {
+			fclose(this->file);
+		}
+		this->file = file;
+		return(true);
+	}
+
+	void flush() {
+		std::size_t until = this->head.load(std::memory_order_acquire);
+		std::unique_lock<std::mutex> lock { this->mutex };
+		this->wake.notify_one();
+		this->written.wait(lock, [&] { return(this->tail >= until or this->stop); });
+	}
+
+private:
+	Slot slots[LOG_RING_SIZE];
+	std::atomic<std::size_t> head { 0 }; // Next position to write.
+	std::atomic<std::size_t> tail { 0 }; // Next position to read, by the drain thread.
+	std::atomic<unsigned long> dropped { 0 };
+
+	std::thread thread;
+	std::mutex mutex; // Only to sleep and to wait for flush().
+	std::condition_variable wake;
+	std::condition_variable written;
+	bool stop = false;
+
+	std::mutex output; // Guards file against open().
+	FILE * file = stdout;
+
+	// Identical warnings of the current second.
+	struct Repeat { std::time_t second; unsigned long count; };
+	std::map<std::string, struct Repeat> repeats;
+
+	bool pop(Entry& entry) {
+		std::size_t tail = this->tail.load(std::memory_order_relaxed);
+		Slot& slot = this->slots[tail & (LOG_RING_SIZE - 1)];
+		if(slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+			return(false);
+		}
+		entry = std::move(slot.entry);
+		slot.sequence.store(tail + LOG_RING_SIZE, std::memory_order_release);
+		this->tail.store(tail + 1, std::memory_order_release);
+		return(true);
+	}
+
+	void drain() {
+		std::unique_lock<std::mutex> lock { this->mutex };
+		while(true) {
+			bool stopping = this->stop;
+			lock.unlock();
+			{
+				std::lock_guard<std::mutex> out { this->output };
+				Entry entry;
+				while(this->pop(entry)) {
+					if(this->limit(entry)) {
+						this->write(entry);
+					}
+				}
+				this->report(stopping);
+				fflush(this->file);
+			}
+			lock.lock();
+			this->written.notify_all();
+			if(stopping) {
+				return;
+			}
+			// Producers don't lock: a missed wake up only delays by the timeout.
+			this->wake.wait_for(lock, std::chrono::milliseconds(100));
+		}
+	}
+
+	bool limit(const Entry& entry) {
+		if(entry.level != LOG_WARNING) {
+			return(true);
+		}
+		struct Repeat& repeat = this->repeats[entry.message];
+		if(repeat.second != entry.time.tv_sec) {
+			repeat = Repeat{ entry.time.tv_sec, 0 };
+		}
+		return(++repeat.count <= LOG_REPEAT_LIMIT);
+	}
+
+	// Say what was suppressed or dropped, once its second is over.
+	void report(bool all) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		auto it = this->repeats.begin();
+		while(it != this->repeats.end()) {
+			if(it->second.second == now.tv_sec and not all) {
+				it++;
+				continue;
+			}
+			if(it->second.count > LOG_REPEAT_LIMIT) {
+				this->write(Entry{ LOG_WARNING, now, "Previous warning repeated "
+					+ std::to_string(it->second.count - LOG_REPEAT_LIMIT) + " more times: " + it->first });
+			}
+			it = this->repeats.erase(it);
+		}
+		unsigned long dropped = this->dropped.exchange(0, std::memory_order_relaxed);
+		if(dropped > 0) {
+			this->write(Entry{ LOG_WARNING, now, std::to_string(dropped) + " log messages dropped." });
+		}
+	}
+
+	void write(const Entry& entry) {
+		static const char * names[] = { "INFO", "WARNING", "FATAL" };
+		if(this->format.load(std::memory_order_relaxed) == LOG_PLAIN) {
+			fprintf(this->file, "[%s] %s\n", names[entry.level], entry.message.c_str());
+			return;
+		}
+		std::string escaped;
+		for(char c : entry.message) {
+			if(c == '"' or c == '\\') {
+				escaped += '\\';
+				escaped += c;
+			} else if((unsigned char) c < 0x20) {
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", c);
+				escaped += code;
+			} else {
+				escaped += c;
+			}
+		}
+		struct tm tm;
+		gmtime_r(&entry.time.tv_sec, &tm);
+		char time[32];
+		strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &tm);
+		fprintf(this->file, "{\"time\":\"%s.%03ldZ\",\"level\":\"%s\",\"message\":\"%s\"}\n",
+			time, entry.time.tv_nsec / 1000000, names[entry.level], escaped.c_str());
+	}
+};
+
+Logger& logger() {
+	static Logger logger;
+	return(logger);
+}
+
+}
 
 void setVerbose() {
-	verbose = true;
+	setLogLevel(LOG_INFO);
 }
 
 void setNoVerbose() {
-	verbose = false;
+	setLogLevel(LOG_WARNING);
 }
 
 bool isVerbose() {
-	return(verbose);
+	return(getLogLevel() == LOG_INFO);
+}
+
+void setLogLevel(LogLevel level) {
+	logger().level = level;
+}
+
+LogLevel getLogLevel() {
+	return(static_cast<LogLevel>(logger().level.load()));
+}
+
+void setLogFormat(LogFormat format) {
+	logger().format = format;
+}
+
+bool openLog(const std::string& filename) {
+	return(logger().open(filename));
+}
+
+void flushLog() {
+	logger().flush();
 }
 
 void info(std::string msg) {
-	if(verbose) {
-		std::cout << "[INFO] " << msg << std::endl;
+	if(logger().level.load(std::memory_order_relaxed) <= LOG_INFO) {
+		logger().push(LOG_INFO, std::move(msg));
 	}
 }
 
 void warning(std::string msg) {
-	std::cout << "[WARNING] " << msg << std::endl;
+	if(logger().level.load(std::memory_order_relaxed) <= LOG_WARNING) {
+		logger().push(LOG_WARNING, std::move(msg));
+	}
 }
 
 void fatal(std::string msg) {
-	std::cout << "[FATAL] " << msg << std::endl;
+	logger().push(LOG_FATAL, std::move(msg));
+	flushLog();
 	exit(1); // XXX ??
 }
-
@@ -2,12 +2,24 @@
 
 #include <string>
 
-// TODO : log into file.
+#define LOG_RING_SIZE 4096 // Pending messages, a power of 2. More are dropped.
+#define LOG_REPEAT_LIMIT 5 // Identical warnings written per second, more are counted.
 
-void setVerbose();
-void setNoVerbose();
+enum LogLevel { LOG_INFO, LOG_WARNING, LOG_FATAL };
+enum LogFormat { LOG_PLAIN, LOG_JSON }; // JSON is one object per line.
+
+// Messages are queued without locking and written by a background thread:
+// logging never blocks, a full queue drops them.
+
+void setVerbose(); // Level LOG_INFO.
+void setNoVerbose(); // Level LOG_WARNING.
 bool isVerbose();
+void setLogLevel(LogLevel level);
+LogLevel getLogLevel();
+void setLogFormat(LogFormat format);
+bool openLog(const std::string& filename); // Append to it; "" is stdout.
+void flushLog(); // Wait until queued messages are written.
 
 void info(std::string msg);
 void warning(std::string msg);
-void fatal(std::string msg);
+void fatal(std::string msg); // Flush and exit.
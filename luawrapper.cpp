@@ -5,11 +5,17 @@
 #include "inventory.h"
 #include "name.h"
 #include "place.h"
+#include "player.h"
 #include "character.h"
 #include "server.h"
 #include "zone.h"
+#include "journal.h"
+#include "metrics.h"
 
 #include <cstdlib> // rand()
+#include <algorithm> // std::min(), std::max()
+#include <climits> // INT_MAX
+#include <cmath> // std::isfinite()
 
 class Server * Luawrapper::server = nullptr;
 
@@ -46,6 +52,18 @@ int l_isverbose(lua_State * lua) {
 	return(1);
 }
 
+int l_log_open(lua_State * lua) {
+	if(not lua_isstring(lua, 1)) {
+		lua_arg_error("log_open(filename, [format])");
+		lua_pushnil(lua);
+	} else {
+		std::string format = lua_isstring(lua, 2) ? lua_tostring(lua, 2) : "plain";
+		setLogFormat(format == "json" ? LOG_JSON : LOG_PLAIN);
+		lua_pushboolean(lua, openLog(lua_tostring(lua, 1)));
+	}
+	return(1);
+}
+
 int l_info(lua_State * lua) {
 	if(not lua_isstring(lua, 1)) {
 		lua_arg_error("info(message)");
@@ -114,6 +132,51 @@ int l_get_port(lua_State * lua) {
 	return(1);
 }
 
+int l_set_output_limit(lua_State * lua) {
+	if(not lua_isinteger(lua, 1)) {
+		lua_arg_error("set_output_limit(bytes)");
+	} else {
+		Player::setOutputLimit(lua_tointeger(lua, 1));
+	}
+	return(0);
+}
+
+int l_get_output_limit(lua_State * lua) {
+	lua_pushinteger(lua, Player::getOutputLimit());
+	return(1);
+}
+
+int l_snapshot_save(lua_State * lua) {
+	if(not lua_isstring(lua, 1)) {
+		lua_arg_error("snapshot_save(filename)");
+		lua_pushnil(lua);
+	} else {
+		lua_pushboolean(lua, Luawrapper::server->saveSnapshot(lua_tostring(lua, 1)));
+	}
+	return(1);
+}
+
+int l_snapshot_load(lua_State * lua) {
+	if(not lua_isstring(lua, 1)) {
+		lua_arg_error("snapshot_load(filename)");
+		lua_pushnil(lua);
+	} else {
+		lua_pushboolean(lua, Luawrapper::server->loadSnapshot(lua_tostring(lua, 1)));
+	}
+	return(1);
+}
+
+int l_journal_open(lua_State * lua) {
+	if(not lua_isstring(lua, 1)) {
+		lua_arg_error("journal_open(filename, [sync_ms])");
+		lua_pushnil(lua);
+	} else {
+		unsigned int sync_interval = lua_isinteger(lua, 2) ? lua_tointeger(lua, 2) : JOURNAL_SYNC_INTERVAL;
+		lua_pushboolean(lua, Luawrapper::server->openJournal(lua_tostring(lua, 1), sync_interval));
+	}
+	return(1);
+}
+
 int l_delete_zone(lua_State * lua) {
 	if(not lua_isstring(lua, 1)) {
 		lua_arg_error("delete_zone(zone_id)");
@@ -190,7 +253,20 @@ int l_create_timer(lua_State * lua) {
 	} else {
 		int duration = lua_tointeger(lua, 1);
 		Script script { lua_tostring(lua, 2) };
-		Uuid id = Luawrapper::server->addTimer(duration, script);
+		Uuid id = Luawrapper::server->addTimer(duration * 1000ul, script, Luawrapper::get(lua));
+		lua_pushstring(lua, id.toString().c_str());
+	}
+	return(1);
+}
+
+int l_create_timer_ms(lua_State * lua) {
+	if(not lua_isnumber(lua, 1) or not lua_isstring(lua, 2)) {
+		lua_arg_error("create_timer_ms(duration, script)");
+		lua_pushnil(lua);
+	} else {
+		int duration = lua_tointeger(lua, 1);
+		Script script { lua_tostring(lua, 2) };
+		Uuid id = Luawrapper::server->addTimer(duration, script, Luawrapper::get(lua));
 		lua_pushstring(lua, id.toString().c_str());
 	}
 	return(1);
@@ -212,7 +288,8 @@ int l_timer_getremaining(lua_State * lua) {
 		lua_pushnil(lua);
 	} else {
 		Uuid id { lua_tostring(lua, 1) };
-		lua_pushinteger(lua, Luawrapper::server->getTimerRemaining(id));
+		// In seconds, rounded up: 0 is not-found.
+		lua_pushinteger(lua, (Luawrapper::server->getTimerRemaining(id) + 999) / 1000);
 	}
 	return(1);
 }
@@ -223,7 +300,7 @@ int l_timer_setremaining(lua_State * lua) {
 	} else {
 		Uuid id { lua_tostring(lua, 1) };
 		int remaining = lua_tointeger(lua, 2);
-		Luawrapper::server->setTimerRemaining(id, remaining);
+		Luawrapper::server->setTimerRemaining(id, remaining * 1000ul);
 	}
 	return(0);
 }
@@ -238,6 +315,105 @@ int l_timer_triggernow(lua_State * lua) {
 	return(0);
 }
 
+/* Coroutines: yield to the server, see Luawrapper::resume(). */
+
+int l_wait(lua_State * lua) {
+	if(not lua_isnumber(lua, 1)) {
+		lua_arg_error("wait(seconds)");
+		return(0);
+	}
+	if(not lua_isyieldable(lua)) {
+		warning("wait() can only be called by scripts, not in a coroutine of their own.");
+		return(0);
+	}
+	lua_Number seconds = lua_tonumber(lua, 1);
+	if(not std::isfinite(seconds)) {
+		lua_arg_error("wait(seconds)");
+		return(0);
+	}
+	// Clamped before converting: out of range, it is undefined.
+	lua_Number duration = std::min(std::max(seconds * 1000, (lua_Number) 0), (lua_Number) TIMER_WHEEL_SPAN);
+	lua_pushstring(lua, "wait");
+	lua_pushinteger(lua, (lua_Integer) duration);
+	return(lua_yield(lua, 2));
+}
+
+int l_wait_for_move(lua_State * lua) {
+	if(not lua_isyieldable(lua)) {
+		warning("wait_for_move() can only be called by scripts, not in a coroutine of their own.");
+		return(0);
+	}
+	lua_pushstring(lua, "move");
+	if(lua_isstring(lua, 1)) {
+		lua_pushstring(lua, lua_tostring(lua, 1));
+	} else {
+		lua_getglobal(lua, "Character");
+	}
+	return(lua_yield(lua, 2));
+}
+
+/* Budgets */
+
+int l_set_script_budget(lua_State * lua) {
+	if(not lua_isstring(lua, 1) or not lua_isinteger(lua, 2)) {
+		lua_arg_error("set_script_budget(trigger, instructions)");
+	} else {
+		Trigger trigger = Luawrapper::toTrigger(lua_tostring(lua, 1));
+		if(trigger == TRIGGER_COUNT) {
+			warning("Trigger '"+std::string(lua_tostring(lua, 1))+"' doesn't exist.");
+		} else {
+			Luawrapper::get(lua)->setBudget(trigger, std::max(lua_tointeger(lua, 2), (lua_Integer) 0));
+		}
+	}
+	return(0);
+}
+
+int l_get_script_budget(lua_State * lua) {
+	if(not lua_isstring(lua, 1)) {
+		lua_arg_error("get_script_budget(trigger)");
+		lua_pushnil(lua);
+	} else {
+		Trigger trigger = Luawrapper::toTrigger(lua_tostring(lua, 1));
+		if(trigger == TRIGGER_COUNT) {
+			warning("Trigger '"+std::string(lua_tostring(lua, 1))+"' doesn't exist.");
+			lua_pushnil(lua);
+		} else {
+			lua_pushinteger(lua, Luawrapper::get(lua)->getBudget(trigger));
+		}
+	}
+	return(1);
+}
+
+int l_stats(lua_State * lua) {
+	lua_newtable(lua);
+	for(const Server::Stat& stat : Luawrapper::server->getStats()) {
+		lua_pushstring(lua, (stat.name + stat.labels).c_str());
+		lua_pushnumber(lua, stat.value);
+		lua_settable(lua, -3);
+	}
+	return(1);
+}
+
+int l_metrics_open(lua_State * lua) {
+	if(not lua_isinteger(lua, 1)) {
+		lua_arg_error("metrics_open(port)");
+		lua_pushnil(lua);
+	} else {
+		lua_pushboolean(lua, Luawrapper::server->openMetrics(lua_tointeger(lua, 1)));
+	}
+	return(1);
+}
+
+int l_script_overruns(lua_State * lua) {
+	lua_newtable(lua);
+	for(auto& it : Luawrapper::get(lua)->getOverruns()) {
+		lua_pushstring(lua, it.first.c_str());
+		lua_pushinteger(lua, it.second);
+		lua_settable(lua, -3);
+	}
+	return(1);
+}
+
 /* Zone */
 
 int l_new_zone(lua_State * lua) {
@@ -258,6 +434,35 @@ int l_new_zone(lua_State * lua) {
 	return(0);
 }
 
+int l_zone_save(lua_State * lua) {
+	if(not lua_isstring(lua, 1) or not lua_isstring(lua, 2)) {
+		lua_arg_error("zone_save(zone_id, filename)");
+		lua_pushnil(lua);
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		if(zone != nullptr) {
+			lua_pushboolean(lua, zone->save(lua_tostring(lua, 2)));
+		} else {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+			lua_pushnil(lua);
+		}
+	}
+	return(1);
+}
+
+int l_zone_load(lua_State * lua) {
+	if(not lua_isstring(lua, 1) or not lua_isstring(lua, 2)) {
+		lua_arg_error("zone_load(zone_id, filename)");
+		lua_pushnil(lua);
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Zone::load(Luawrapper::server, zone_id, lua_tostring(lua, 2));
+		lua_pushboolean(lua, zone != nullptr);
+	}
+	return(1);
+}
+
 int l_assert_zone(lua_State * lua) {
 	if(not lua_isstring(lua, 1)) {
 		lua_arg_error("assert_zone(zone_id)");
@@ -341,6 +546,71 @@ int l_zone_getheight(lua_State * lua) {
 	return(1);
 }
 
+int l_zone_getviewradius(lua_State * lua) {
+	if(not lua_isstring(lua, 1)) {
+		lua_arg_error("zone_getviewradius(zone_id)");
+		lua_pushnil(lua);
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		if(zone != nullptr) {
+			lua_pushinteger(lua, zone->getViewRadius());
+		} else {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+			lua_pushnil(lua);
+		}
+	}
+	return(1);
+}
+
+int l_zone_setviewradius(lua_State * lua) {
+	if(not lua_isstring(lua, 1) or not lua_isinteger(lua, 2)) {
+		lua_arg_error("zone_setviewradius(zone_id, radius)");
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		if(zone != nullptr) {
+			zone->setViewRadius(lua_tointeger(lua, 2));
+		} else {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+		}
+	}
+	return(0);
+}
+
+int l_zone_setvm(lua_State * lua) {
+	if(not lua_isstring(lua, 1) or not lua_isstring(lua, 2)) {
+		lua_arg_error("zone_setvm(zone_id, vm, [init_script])");
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		if(zone != nullptr) {
+			std::string init_script = lua_isstring(lua, 3) ? lua_tostring(lua, 3) : "";
+			zone->setLua(Luawrapper::server->getLua(lua_tostring(lua, 2), init_script));
+		} else {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+		}
+	}
+	return(0);
+}
+
+int l_zone_getvm(lua_State * lua) {
+	if(not lua_isstring(lua, 1)) {
+		lua_arg_error("zone_getvm(zone_id)");
+		lua_pushnil(lua);
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		if(zone != nullptr) {
+			lua_pushstring(lua, zone->getLua()->getName().c_str());
+		} else {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+			lua_pushnil(lua);
+		}
+	}
+	return(1);
+}
+
 int l_zone_event(lua_State * lua) {
 	if(not lua_isstring(lua, 1) or not lua_isstring(lua, 2)) {
 		lua_arg_error("zone_event(zone_id, message)");
@@ -371,9 +641,9 @@ int l_place_getaspect(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
-				lua_pushstring(lua, place->getAspect().toString().c_str());
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
+				lua_pushstring(lua, place.getAspect().toString().c_str());
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -400,17 +670,17 @@ int l_place_setaspect(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
 				// Set aspect.
 				Aspect aspect { lua_tostring(lua, 4) };
-				place->setAspect(aspect);
+				place.setAspect(aspect);
 
 				// Set default passability.
 				if(Aspect::getAspectDefaultPassable(aspect)) {
-					place->setWalkable();
+					place.setWalkable();
 				} else {
-					place->setNotWalkable();
+					place.setNotWalkable();
 				}
 
 				// Update place aspect.
@@ -440,9 +710,9 @@ int l_place_ispassable(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
-				lua_pushboolean(lua, place->isWalkable());
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
+				lua_pushboolean(lua, place.isWalkable());
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -468,9 +738,9 @@ int l_place_setpassable(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
-				place->setWalkable();
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
+				place.setWalkable();
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -495,9 +765,9 @@ int l_place_setnotpassable(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
-				place->setNotWalkable();
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
+				place.setNotWalkable();
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -523,9 +793,9 @@ int l_place_getlandon(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
-				lua_pushstring(lua, place->getWhenWalkedOn().toString().c_str());
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
+				lua_pushstring(lua, place.getWhenWalkedOn().toString().c_str());
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -552,10 +822,10 @@ int l_place_setlandon(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
 				Script script { lua_tostring(lua, 4) };
-				place->setWhenWalkedOn(script);
+				place.setWhenWalkedOn(script);
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -580,9 +850,9 @@ int l_place_resetlandon(lua_State * lua) {
 		if(zone != nullptr) {
 			unsigned int x = lua_tointeger(lua, 2);
 			unsigned int y = lua_tointeger(lua, 3);
-			class Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
-				place->resetWhenWalkedOn();
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
+				place.resetWhenWalkedOn();
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -609,10 +879,10 @@ int l_place_gettag(lua_State * lua) {
 		if(zone != nullptr) {
 			int x = lua_tointeger(lua, 2);
 			int y = lua_tointeger(lua, 3);
-			Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
 				TagID tag_id { lua_tostring(lua, 4) };
-				lua_pushstring(lua, place->getTag(tag_id).toString().c_str());
+				lua_pushstring(lua, place.getTag(tag_id).toString().c_str());
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -640,11 +910,11 @@ int l_place_settag(lua_State * lua) {
 		if(zone != nullptr) {
 			int x = lua_tointeger(lua, 2);
 			int y = lua_tointeger(lua, 3);
-			Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
 				TagID tag_id = TagID { lua_tostring(lua, 4) };
 				TagValue value = TagValue { lua_tostring(lua, 5) };
-				place->setTag(tag_id, value);
+				place.setTag(tag_id, value);
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -670,10 +940,10 @@ int l_place_deltag(lua_State * lua) {
 		if(zone != nullptr) {
 			int x = lua_tointeger(lua, 2);
 			int y = lua_tointeger(lua, 3);
-			Place * place = zone->getPlace(x, y);
-			if(place != nullptr) {
+			class Place place = zone->getPlace(x, y);
+			if(place.isValid()) {
 				TagID tag_id = TagID { lua_tostring(lua, 4) };
-				place->delTag(tag_id);
+				place.delTag(tag_id);
 			} else {
 				warning("Invalid place "
 					+ std::to_string(x) + "-" + std::to_string(y)
@@ -687,6 +957,158 @@ int l_place_deltag(lua_State * lua) {
 	return(0);
 }
 
+/* Places in bulk: one floor update per character. */
+
+// Set the aspect and its default passability, without broadcasting it.
+void set_place_aspect(class Place& place, const Aspect& aspect) {
+	place.setAspect(aspect);
+	if(Aspect::getAspectDefaultPassable(aspect)) {
+		place.setWalkable();
+	} else {
+		place.setNotWalkable();
+	}
+}
+
+int l_place_fill_rect(lua_State * lua) {
+	if(not lua_isstring(lua, 1)
+			or not lua_isnumber(lua, 2)
+			or not lua_isnumber(lua, 3)
+			or not lua_isnumber(lua, 4)
+			or not lua_isnumber(lua, 5)
+			or not lua_isstring(lua, 6)) {
+		lua_arg_error("place_fill_rect(zone_id, x, y, w, h, aspect)");
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		if(zone != nullptr) {
+			// Clip to the zone.
+			int x_min = std::max((int) lua_tointeger(lua, 2), 0);
+			int y_min = std::max((int) lua_tointeger(lua, 3), 0);
+			int x_max = std::min((int) (lua_tointeger(lua, 2) + lua_tointeger(lua, 4)), (int) zone->getWidth());
+			int y_max = std::min((int) (lua_tointeger(lua, 3) + lua_tointeger(lua, 5)), (int) zone->getHeight());
+			Aspect aspect { lua_tostring(lua, 6) };
+			for(int y = y_min; y < y_max; y++) {
+				for(int x = x_min; x < x_max; x++) {
+					class Place place = zone->getPlace(x, y);
+					set_place_aspect(place, aspect);
+				}
+			}
+			if(x_min < x_max and y_min < y_max) {
+				zone->updatePlaceAspects(x_min, y_min, x_max - x_min, y_max - y_min);
+			}
+		} else {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+		}
+	}
+	return(0);
+}
+
+int l_place_setaspect_many(lua_State * lua) {
+	if(not lua_isstring(lua, 1) or not lua_istable(lua, 2)) {
+		lua_arg_error("place_setaspect_many(zone_id, {{x, y, aspect}, ...})");
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		if(zone != nullptr) {
+			// Bounding box of the changed places.
+			int x_min = zone->getWidth();
+			int y_min = zone->getHeight();
+			int x_max = -1;
+			int y_max = -1;
+			const char * last_name = nullptr; // Same pointer, same string.
+			Aspect aspect {};
+			lua_Integer n = lua_rawlen(lua, 2);
+			for(lua_Integer i = 1; i <= n; i++) {
+				lua_rawgeti(lua, 2, i);
+				if(lua_istable(lua, -1)) {
+					lua_rawgeti(lua, -1, 1);
+					lua_rawgeti(lua, -2, 2);
+					lua_rawgeti(lua, -3, 3);
+					if(lua_isnumber(lua, -3) and lua_isnumber(lua, -2) and lua_isstring(lua, -1)) {
+						int x = lua_tointeger(lua, -3);
+						int y = lua_tointeger(lua, -2);
+						bool kept = lua_type(lua, -1) == LUA_TSTRING; // Not a converted number.
+						const char * name = lua_tostring(lua, -1);
+						if(name != last_name) {
+							aspect = Aspect { name };
+						}
+						last_name = kept ? name : nullptr;
+						if(zone->isPlaceValid(x, y)) {
+							class Place place = zone->getPlace(x, y);
+							set_place_aspect(place, aspect);
+							x_min = std::min(x_min, x);
+							y_min = std::min(y_min, y);
+							x_max = std::max(x_max, x);
+							y_max = std::max(y_max, y);
+						}
+					}
+					lua_pop(lua, 3);
+				}
+				lua_pop(lua, 1);
+			}
+			if(x_max >= 0) {
+				zone->updatePlaceAspects(x_min, y_min, x_max - x_min + 1, y_max - y_min + 1);
+			}
+		} else {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+		}
+	}
+	return(0);
+}
+
+int l_zone_load_layer(lua_State * lua) {
+	if(not lua_isstring(lua, 1)
+			or not lua_isnumber(lua, 2)
+			or not lua_isnumber(lua, 3)
+			or not lua_isnumber(lua, 4)
+			or not lua_istable(lua, 5)) {
+		lua_arg_error("zone_load_layer(zone_id, x, y, w, {aspect, ...})");
+	} else {
+		std::string zone_id = lua_tostring(lua, 1);
+		class Zone * zone = Luawrapper::server->getZone(zone_id);
+		int x0 = lua_tointeger(lua, 2);
+		int y0 = lua_tointeger(lua, 3);
+		int w = lua_tointeger(lua, 4);
+		if(zone != nullptr and w > 0) {
+			// Aspects row by row, w per row.
+			lua_Integer n = lua_rawlen(lua, 5);
+			const char * last_name = nullptr; // Same pointer, same string.
+			Aspect aspect {};
+			for(lua_Integer i = 0; i < n; i++) {
+				int x = x0 + i % w;
+				int y = y0 + i / w;
+				if(not zone->isPlaceValid(x, y)) {
+					continue;
+				}
+				lua_rawgeti(lua, 5, i + 1);
+				if(lua_isstring(lua, -1)) {
+					bool kept = lua_type(lua, -1) == LUA_TSTRING; // Not a converted number.
+					const char * name = lua_tostring(lua, -1);
+					if(name != last_name) {
+						aspect = Aspect { name };
+					}
+					last_name = kept ? name : nullptr;
+					class Place place = zone->getPlace(x, y);
+					set_place_aspect(place, aspect);
+				}
+				lua_pop(lua, 1);
+			}
+
+			int h = (n + w - 1) / w;
+			int x_min = std::max(x0, 0);
+			int y_min = std::max(y0, 0);
+			int x_max = std::min(x0 + w, (int) zone->getWidth());
+			int y_max = std::min(y0 + h, (int) zone->getHeight());
+			if(x_min < x_max and y_min < y_max) {
+				zone->updatePlaceAspects(x_min, y_min, x_max - x_min, y_max - y_min);
+			}
+		} else if(zone == nullptr) {
+			warning("Zone '"+zone_id+"' doesn't exist.");
+		}
+	}
+	return(0);
+}
+
 /* Character */
 
 int l_delete_character(lua_State * lua) {
@@ -1651,7 +2073,9 @@ int l_artifact_settag(lua_State * lua) {
 		return(0);
 	}
 
-	artifact->setTag(TagID{ lua_tostring(lua, 2) }, TagValue{ lua_tostring(lua, 3) });
+	TagID tag_id { lua_tostring(lua, 2) };
+	TagValue value { lua_tostring(lua, 3) };
+	artifact->setTag(tag_id, value);
 	return(0);
 }
 
@@ -1669,7 +2093,8 @@ int l_artifact_deltag(lua_State * lua) {
 		return(0);
 	}
 
-	artifact->delTag(TagID{ lua_tostring(lua, 2) });
+	TagID tag_id { lua_tostring(lua, 2) };
+	artifact->delTag(tag_id);
 	return(0);
 }
 
@@ -1961,17 +2386,27 @@ int l_inventory_move_all(lua_State * lua) {
 
 /* Wraper class */
 
-Luawrapper::Luawrapper(class Server * server) :
-	lua_state(luaL_newstate())
+static const char * trigger_names[TRIGGER_COUNT] = { "other", "action", "landon", "timer", "gauge", "death" };
+
+Luawrapper::Luawrapper(class Server * server, const std::string& name, const std::string& init_script) :
+	lua_state(luaL_newstate()),
+	name(name)
 {
 	Luawrapper::server = server;
 	luaL_openlibs(this->lua_state);
+	lua_pushlightuserdata(this->lua_state, this);
+	lua_setfield(this->lua_state, LUA_REGISTRYINDEX, LUA_WRAPPER_KEY);
+	for(unsigned int trigger = 0; trigger < TRIGGER_COUNT; trigger++) {
+		this->budgets[trigger] = LUA_DEFAULT_BUDGET;
+		this->timings[trigger] = &Metrics::histogram("script_seconds", "trigger=\""+std::string(trigger_names[trigger])+"\"");
+	}
 
 	lua_register(this->lua_state, "c_rand", l_c_rand);
 
 	lua_register(this->lua_state, "setverbose", l_setverbose);
 	lua_register(this->lua_state, "setnoverbose", l_setnoverbose);
 	lua_register(this->lua_state, "isverbose", l_isverbose);
+	lua_register(this->lua_state, "log_open", l_log_open);
 	lua_register(this->lua_state, "info", l_info);
 	lua_register(this->lua_state, "warning", l_warning);
 	lua_register(this->lua_state, "fatal", l_fatal);
@@ -1981,6 +2416,11 @@ Luawrapper::Luawrapper(class Server * server) :
 	lua_register(this->lua_state, "close", l_close);
 	lua_register(this->lua_state, "is_open", l_is_open);
 	lua_register(this->lua_state, "get_port", l_get_port);
+	lua_register(this->lua_state, "set_output_limit", l_set_output_limit);
+	lua_register(this->lua_state, "get_output_limit", l_get_output_limit);
+	lua_register(this->lua_state, "snapshot_save", l_snapshot_save);
+	lua_register(this->lua_state, "snapshot_load", l_snapshot_load);
+	lua_register(this->lua_state, "journal_open", l_journal_open);
 	lua_register(this->lua_state, "delete_zone", l_delete_zone);
 	lua_register(this->lua_state, "add_action", l_add_action);
 	lua_register(this->lua_state, "get_action", l_get_action);
@@ -1988,17 +2428,31 @@ Luawrapper::Luawrapper(class Server * server) :
 	lua_register(this->lua_state, "register_aspect", l_register_aspect);
 
 	lua_register(this->lua_state, "create_timer", l_create_timer);
+	lua_register(this->lua_state, "create_timer_ms", l_create_timer_ms);
 	lua_register(this->lua_state, "delete_timer", l_delete_timer);
 	lua_register(this->lua_state, "timer_getremaining", l_timer_getremaining);
 	lua_register(this->lua_state, "timer_setremaining", l_timer_setremaining);
 	lua_register(this->lua_state, "timer_triggernow", l_timer_triggernow);
+	lua_register(this->lua_state, "wait", l_wait);
+	lua_register(this->lua_state, "wait_for_move", l_wait_for_move);
+	lua_register(this->lua_state, "set_script_budget", l_set_script_budget);
+	lua_register(this->lua_state, "get_script_budget", l_get_script_budget);
+	lua_register(this->lua_state, "script_overruns", l_script_overruns);
+	lua_register(this->lua_state, "stats", l_stats);
+	lua_register(this->lua_state, "metrics_open", l_metrics_open);
 
 	lua_register(this->lua_state, "new_zone", l_new_zone);
+	lua_register(this->lua_state, "zone_save", l_zone_save);
+	lua_register(this->lua_state, "zone_load", l_zone_load);
 	lua_register(this->lua_state, "assert_zone", l_assert_zone);
 	lua_register(this->lua_state, "zone_getname", l_zone_getname);
 	lua_register(this->lua_state, "zone_setname", l_zone_setname);
 	lua_register(this->lua_state, "zone_getwidth", l_zone_getwidth);
 	lua_register(this->lua_state, "zone_getheight", l_zone_getheight);
+	lua_register(this->lua_state, "zone_getviewradius", l_zone_getviewradius);
+	lua_register(this->lua_state, "zone_setviewradius", l_zone_setviewradius);
+	lua_register(this->lua_state, "zone_setvm", l_zone_setvm);
+	lua_register(this->lua_state, "zone_getvm", l_zone_getvm);
 	lua_register(this->lua_state, "zone_event", l_zone_event);
 
 	lua_register(this->lua_state, "place_getaspect", l_place_getaspect);
@@ -2012,6 +2466,9 @@ Luawrapper::Luawrapper(class Server * server) :
 	lua_register(this->lua_state, "place_gettag", l_place_gettag);
 	lua_register(this->lua_state, "place_settag", l_place_settag);
 	lua_register(this->lua_state, "place_deltag", l_place_deltag);
+	lua_register(this->lua_state, "place_fill_rect", l_place_fill_rect);
+	lua_register(this->lua_state, "place_setaspect_many", l_place_setaspect_many);
+	lua_register(this->lua_state, "zone_load_layer", l_zone_load_layer);
 
 	lua_register(this->lua_state, "delete_character", l_delete_character);
 	lua_register(this->lua_state, "assert_character", l_assert_character);
@@ -2079,36 +2536,206 @@ Luawrapper::Luawrapper(class Server * server) :
 	lua_register(this->lua_state, "inventory_move", l_inventory_move);
 	lua_register(this->lua_state, "inventory_move_all", l_inventory_move_all);
 
-	this->executeFile(LUA_INIT_SCRIPT);
+	if(not init_script.empty()) {
+		this->executeFile(init_script);
+	}
 }
 
 Luawrapper::~Luawrapper() {
+	// Scripts may still hold the chunks.
+	for(auto& chunk : this->chunk_list) {
+		chunk->ref = LUA_NOREF;
+	}
 	lua_close(this->lua_state);
 }
 
+class Luawrapper * Luawrapper::get(lua_State * lua) {
+	lua_getfield(lua, LUA_REGISTRYINDEX, LUA_WRAPPER_KEY);
+	class Luawrapper * wrapper = static_cast<class Luawrapper *>(lua_touserdata(lua, -1));
+	lua_pop(lua, 1);
+	return(wrapper);
+}
+
+const std::string& Luawrapper::getName() {
+	return(this->name);
+}
+
 void Luawrapper::executeFile(std::string filename, class Character * character, std::string arg) {
-	if(character) {
-		lua_pushstring(this->lua_state, character->getId().toString().c_str());
-	} else {
-		lua_pushnil(this->lua_state);
+	this->setGlobals(character, arg);
+	luaL_dofile(this->lua_state, filename.c_str());
+}
+
+void Luawrapper::executeCode(std::string code, class Character * character, std::string arg) {
+	this->setGlobals(character, arg);
+	luaL_dostring(this->lua_state, code.c_str());
+}
+
+std::shared_ptr<struct Luawrapper::Chunk> Luawrapper::compile(const std::string& code) {
+	auto it = this->chunks.find(code);
+	if(it != this->chunks.end()) {
+		this->chunk_list.splice(this->chunk_list.begin(), this->chunk_list, it->second);
+		return(*it->second);
 	}
-	lua_setglobal(this->lua_state, "Character");
 
-	if(arg == "") {
-		lua_pushnil(this->lua_state);
+	std::shared_ptr<struct Chunk> chunk = std::make_shared<struct Chunk>(Chunk{ code, LUA_REFNIL });
+	if(luaL_loadstring(this->lua_state, code.c_str()) == LUA_OK) {
+		chunk->ref = luaL_ref(this->lua_state, LUA_REGISTRYINDEX);
 	} else {
-		lua_pushstring(this->lua_state, arg.c_str());
+		warning("Lua script doesn't compile: " + std::string(lua_tostring(this->lua_state, -1)));
+		lua_pop(this->lua_state, 1);
 	}
-	lua_setglobal(this->lua_state, "Arg");
 
-	luaL_dofile(this->lua_state, filename.c_str());
+	// Scripts built with ids in them are all different: keep the recent ones only.
+	if(this->chunk_list.size() >= LUA_CHUNK_CACHE) {
+		std::shared_ptr<struct Chunk>& oldest = this->chunk_list.back();
+		if(oldest->ref != LUA_REFNIL) {
+			// Running coroutines keep the function on their stack.
+			luaL_unref(this->lua_state, LUA_REGISTRYINDEX, oldest->ref);
+		}
+		oldest->ref = LUA_NOREF; // Its scripts compile it again.
+		this->chunks.erase(oldest->code);
+		this->chunk_list.pop_back();
+	}
+	this->chunk_list.push_front(chunk);
+	this->chunks[code] = this->chunk_list.begin();
+	return(chunk);
 }
 
-void Luawrapper::executeCode(std::string code, class Character * character, std::string arg) {
-	if(character) {
-		lua_pushstring(this->lua_state, character->getId().toString().c_str());
+void Luawrapper::executeChunk(const std::shared_ptr<struct Chunk>& chunk, class Character * character, std::string arg, Trigger trigger) {
+	if(chunk == nullptr or chunk->ref == LUA_REFNIL or chunk->ref == LUA_NOREF) {
+		return;
+	}
+	// Scripts that didn't wait leave their coroutine for the next one.
+	if(this->idle.thread == nullptr) {
+		this->idle.thread = lua_newthread(this->lua_state);
+		this->idle.ref = luaL_ref(this->lua_state, LUA_REGISTRYINDEX);
+	}
+	struct Coroutine coroutine = this->idle;
+	this->idle = Coroutine{ LUA_NOREF, nullptr, nullptr, TRIGGER_OTHER, "", "" };
+	coroutine.chunk = chunk;
+	coroutine.trigger = trigger;
+	coroutine.character = character ? character->getId().toString() : "";
+	coroutine.arg = arg;
+	lua_rawgeti(coroutine.thread, LUA_REGISTRYINDEX, chunk->ref);
+	this->resume(coroutine);
+}
+
+void Luawrapper::resume(int thread) {
+	auto it = this->coroutines.find(thread);
+	if(it == this->coroutines.end()) {
+		return;
+	}
+	struct Coroutine coroutine = std::move(it->second);
+	this->coroutines.erase(it);
+	this->resume(coroutine);
+}
+
+Trigger Luawrapper::toTrigger(const std::string& name) {
+	for(unsigned int trigger = 0; trigger < TRIGGER_COUNT; trigger++) {
+		if(name == trigger_names[trigger]) {
+			return(static_cast<Trigger>(trigger));
+		}
+	}
+	return(TRIGGER_COUNT);
+}
+
+std::size_t Luawrapper::getMemory() {
+	return(lua_gc(this->lua_state, LUA_GCCOUNT, 0) * 1024ul + lua_gc(this->lua_state, LUA_GCCOUNTB, 0));
+}
+
+unsigned long Luawrapper::getBudget(Trigger trigger) {
+	return(this->budgets[trigger]);
+}
+
+void Luawrapper::setBudget(Trigger trigger, unsigned long instructions) {
+	this->budgets[trigger] = instructions;
+}
+
+std::map<std::string, unsigned long> Luawrapper::getOverruns() {
+	return(this->overruns);
+}
+
+void Luawrapper::release(int thread) {
+	if(this->coroutines.erase(thread) > 0) {
+		luaL_unref(this->lua_state, LUA_REGISTRYINDEX, thread);
+	}
+}
+
+void Luawrapper::spawnScript(class Character * character) {
+	this->executeFile(LUA_SPAWN_SCRIPT, character);
+}
+
+// PRIVATE
+
+void Luawrapper::resume(struct Coroutine& coroutine) {
+	lua_State * thread = coroutine.thread;
+	int ref = coroutine.ref;
+	this->setGlobals(coroutine.character, coroutine.arg);
+	// The count hook only runs once the budget is spent: no cost before.
+	unsigned long budget = this->budgets[coroutine.trigger];
+	lua_sethook(thread, budget ? Luawrapper::budgetHook : nullptr, budget ? LUA_MASKCOUNT : 0, std::min(budget, (unsigned long) INT_MAX));
+	this->overrun = false;
+	std::uint64_t start = Metrics::now();
+#if LUA_VERSION_NUM >= 504
+	int results;
+	int status = lua_resume(thread, this->lua_state, 0, &results);
+#else
+	int status = lua_resume(thread, this->lua_state, 0);
+#endif
+	this->timings[coroutine.trigger]->record(Metrics::now() - start);
+	bool overrun = this->overrun;
+	this->overrun = false;
+
+	if(status == LUA_YIELD) {
+		// Yielded by wait() or wait_for_move(): values are (what, argument).
+		std::string what = lua_gettop(thread) >= 2 and lua_isstring(thread, -2) ? lua_tostring(thread, -2) : "";
+		if(what == "wait") {
+			unsigned long duration = lua_tointeger(thread, -1);
+			lua_settop(thread, 0);
+			this->coroutines[ref] = std::move(coroutine);
+			Luawrapper::server->addWait(duration, this, ref);
+			return;
+		}
+		if(what == "move") {
+			Uuid id { lua_isstring(thread, -1) ? lua_tostring(thread, -1) : "" };
+			class Character * character = Luawrapper::server->getCharacter(id);
+			lua_settop(thread, 0);
+			if(character != nullptr) {
+				this->coroutines[ref] = std::move(coroutine);
+				character->waitMove(this, ref);
+				return;
+			}
+			warning("wait_for_move(): character '"+id.toString()+"' doesn't exist.");
+		} else {
+			warning("Lua script yielded without wait(): stopped.");
+		}
+	} else if(overrun) {
+		this->overruns[coroutine.chunk->code]++; // Held by the coroutine: even evicted since.
+		warning("Lua script aborted: over its budget of "+std::to_string(budget)+" instructions.");
+	} else if(status != LUA_OK) {
+		warning("Lua script failed: " + std::string(lua_tostring(thread, -1)));
+	}
+
+	lua_settop(thread, 0);
+	if(status == LUA_OK and this->idle.thread == nullptr) {
+		this->idle = Coroutine{ ref, thread, nullptr, TRIGGER_OTHER, "", "" };
 	} else {
+		luaL_unref(this->lua_state, LUA_REGISTRYINDEX, ref); // Collected.
+	}
+}
+
+void Luawrapper::budgetHook(lua_State * lua, lua_Debug * debug) {
+	Luawrapper::get(lua)->overrun = true;
+	// Fire again at every instruction: a pcall() can't carry on.
+	lua_sethook(lua, Luawrapper::budgetHook, LUA_MASKCOUNT, 1);
+	luaL_error(lua, "instruction budget exceeded");
+}
+
+void Luawrapper::setGlobals(const std::string& character, const std::string& arg) {
+	if(character.empty()) {
 		lua_pushnil(this->lua_state);
+	} else {
+		lua_pushstring(this->lua_state, character.c_str());
 	}
 	lua_setglobal(this->lua_state, "Character");
 
@@ -2118,10 +2745,8 @@ void Luawrapper::executeCode(std::string code, class Character * character, std:
 		lua_pushstring(this->lua_state, arg.c_str());
 	}
 	lua_setglobal(this->lua_state, "Arg");
-
-	luaL_dostring(this->lua_state, code.c_str());
 }
 
-void Luawrapper::spawnScript(class Character * character) {
-	this->executeFile(LUA_SPAWN_SCRIPT, character);
+void Luawrapper::setGlobals(class Character * character, std::string arg) {
+	this->setGlobals(character ? character->getId().toString() : "", arg);
 }
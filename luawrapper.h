@@ -2,6 +2,7 @@
 
 class Server;
 class Character;
+class Histogram;
 
 extern "C" {
 #include <lua.h>
@@ -10,20 +11,84 @@ extern "C" {
 }
 
 #include <string>
+#include <map>
+#include <list>
+#include <memory>
+#include <unordered_map>
 
 #define LUA_INIT_SCRIPT "init.lua"
 #define LUA_SPAWN_SCRIPT "spawn.lua"
+#define LUA_WRAPPER_KEY "hackraft.wrapper" // Registry field pointing back to the Luawrapper.
+#define LUA_DEFAULT_BUDGET 10000000 // Instructions per script run, 0 is unlimited.
+#define LUA_CHUNK_CACHE 1024 // Compiled codes kept; the least recently compiled are released.
+
+// What ran a script: each has its own instruction budget.
+enum Trigger : unsigned int {
+	TRIGGER_OTHER,
+	TRIGGER_ACTION,
+	TRIGGER_LANDON,
+	TRIGGER_TIMER,
+	TRIGGER_GAUGE,
+	TRIGGER_DEATH,
+	TRIGGER_COUNT
+};
 
 class Luawrapper {
 public:
-	static class Server * server;
+	static class Server * server; // Shared by every VM: there is one world.
 
-	Luawrapper(class Server * server);
+	// Each Luawrapper is an isolated VM: own globals, heap and GC.
+	// The init script isn't run if empty.
+	Luawrapper(class Server * server, const std::string& name = "", const std::string& init_script = LUA_INIT_SCRIPT);
 	~Luawrapper();
+
+	static class Luawrapper * get(lua_State * lua); // VM of a binding's state.
+	const std::string& getName(); // "" for the main VM.
+
 	void executeFile(std::string filename, class Character * character = nullptr, std::string arg = ""); // XXX
 	void executeCode(std::string code, class Character * character = nullptr, std::string arg = "");
 	void spawnScript(class Character * character);
 
+	// Compiled function of a code, in the registry of its VM. The ref is
+	// LUA_REFNIL if it doesn't compile, LUA_NOREF once evicted or the VM gone.
+	struct Chunk { std::string code; int ref; };
+	// Compile code once: identical codes share the chunk.
+	std::shared_ptr<struct Chunk> compile(const std::string& code);
+	// Run as a coroutine: the script may wait() and be resumed later.
+	// Aborted past the budget of its trigger, each resume having a new one.
+	void executeChunk(const std::shared_ptr<struct Chunk>& chunk, class Character * character = nullptr, std::string arg = "", Trigger trigger = TRIGGER_OTHER);
+
+	/* Budgets, in instructions; 0 is unlimited. */
+	static Trigger toTrigger(const std::string& name); // TRIGGER_COUNT if unknown.
+	unsigned long getBudget(Trigger trigger);
+	void setBudget(Trigger trigger, unsigned long instructions);
+	std::map<std::string, unsigned long> getOverruns(); // Aborted runs, by script.
+
+	std::size_t getMemory(); // Bytes used by the VM.
+
+	/* Waiting coroutines, by reference */
+	void resume(int thread); // With the globals it started with.
+	void release(int thread); // Won't be resumed.
+
 private:
 	lua_State * lua_state;
+	std::string name;
+	// Compiled codes, the most recent first, and by text.
+	std::list<std::shared_ptr<struct Chunk>> chunk_list;
+	std::unordered_map<std::string, std::list<std::shared_ptr<struct Chunk>>::iterator> chunks;
+
+	struct Coroutine { int ref; lua_State * thread; std::shared_ptr<struct Chunk> chunk; Trigger trigger; std::string character; std::string arg; };
+	std::map<int, struct Coroutine> coroutines; // Waiting ones.
+	struct Coroutine idle { LUA_NOREF, nullptr, nullptr, TRIGGER_OTHER, "", "" }; // Finished, reused by the next script.
+
+	unsigned long budgets[TRIGGER_COUNT];
+	class Histogram * timings[TRIGGER_COUNT]; // Run times, by trigger.
+	std::map<std::string, unsigned long> overruns; // By code.
+	bool overrun = false; // Set by the hook aborting a script.
+
+	static void budgetHook(lua_State * lua, lua_Debug * debug);
+
+	void resume(struct Coroutine& coroutine);
+	void setGlobals(class Character * character, std::string arg);
+	void setGlobals(const std::string& character, const std::string& arg);
 };
@@ -0,0 +1,98 @@
+#include "metrics.h"
+
+#include <ctime> // clock_gettime()
+
+/* Histogram */
+
+// Values below 2^SUB_BITS have their own bucket; above, each power of 2 is
+// split in 2^SUB_BITS buckets.
+static unsigned int bucketOf(std::uint64_t value) {
+	const std::uint64_t linear = 1ull << HISTOGRAM_SUB_BITS;
+	if(value < linear) {
+		return(value);
+	}
+	unsigned int exponent = 63 - __builtin_clzll(value);
+	unsigned int sub = (value >> (exponent - HISTOGRAM_SUB_BITS)) & (linear - 1);
+	return(((exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + sub);
+}
+
+static std::uint64_t lowerBound(unsigned int bucket) {
+	const std::uint64_t linear = 1ull << HISTOGRAM_SUB_BITS;
+	if(bucket < linear) {
+		return(bucket);
+	}
+	unsigned int exponent = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+	std::uint64_t sub = bucket & (linear - 1);
+	return((linear + sub) << (exponent - HISTOGRAM_SUB_BITS));
+}
+
+void Histogram::record(std::uint64_t value) {
+	this->buckets[bucketOf(value)]++;
+	this->count++;
+	this->sum += value;
+	if(value > this->max) {
+		this->max = value;
+	}
+}
+
+std::uint64_t Histogram::getCount() const {
+	return(this->count);
+}
+
+std::uint64_t Histogram::getSum() const {
+	return(this->sum);
+}
+
+std::uint64_t Histogram::getMax() const {
+	return(this->max);
+}
+
+std::uint64_t Histogram::getPercentile(double percent) const {
+	if(this->count == 0) {
+		return(0);
+	}
+	std::uint64_t rank = (percent / 100) * this->count;
+	if(rank >= this->count) {
+		rank = this->count - 1;
+	}
+	std::uint64_t seen = 0;
+	for(unsigned int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+		seen += this->buckets[bucket];
+		if(seen > rank) {
+			return(lowerBound(bucket));
+		}
+	}
+	return(this->max);
+}
+
+/* Metrics */
+
+std::atomic<std::uint64_t> Metrics::counters[COUNTER_COUNT];
+std::map<std::pair<std::string, std::string>, Histogram> Metrics::histograms;
+
+std::uint64_t Metrics::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+void Metrics::count(Counter counter, std::uint64_t n) {
+	Metrics::counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t Metrics::get(Counter counter) {
+	return(Metrics::counters[counter].load(std::memory_order_relaxed));
+}
+
+const char * Metrics::getName(Counter counter) {
+	static const char * names[COUNTER_COUNT] = { "messages_sent", "bytes_written", "connections" };
+	return(names[counter]);
+}
+
+Histogram& Metrics::histogram(const std::string& metric, const std::string& label) {
+	return(Metrics::histograms[std::make_pair(metric, label)]);
+}
+
+const std::map<std::pair<std::string, std::string>, Histogram>& Metrics::getHistograms() {
+	return(Metrics::histograms);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+#define HISTOGRAM_SUB_BITS 3 // 8 linear buckets per power of 2: 12.5% precision.
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+// Log-linear histogram of durations in nanoseconds, like HDR histograms:
+// constant relative precision from 1 ns to centuries, fixed size.
+class Histogram {
+public:
+	void record(std::uint64_t value);
+	std::uint64_t getCount() const;
+	std::uint64_t getSum() const;
+	std::uint64_t getMax() const;
+	std::uint64_t getPercentile(double percent) const; // Lower bound of its bucket.
+
+private:
+	std::uint64_t buckets[HISTOGRAM_BUCKETS] = {};
+	std::uint64_t count = 0;
+	std::uint64_t sum = 0;
+	std::uint64_t max = 0;
+};
+
+enum Counter : unsigned int {
+	COUNTER_MESSAGES, // Lines queued for players.
+	COUNTER_BYTES, // Written to players.
+	COUNTER_CONNECTIONS,
+	COUNTER_COUNT
+};
+
+// Process-wide metrics. Counters may be incremented by any thread,
+// histograms only by the main one.
+class Metrics {
+public:
+	static std::uint64_t now(); // Nanoseconds, monotonic.
+
+	static void count(Counter counter, std::uint64_t n = 1);
+	static std::uint64_t get(Counter counter);
+	static const char * getName(Counter counter);
+
+	// Histograms by metric then labels, e.g. ("script_seconds", "trigger=\"landon\"").
+	static Histogram& histogram(const std::string& metric, const std::string& label);
+	static const std::map<std::pair<std::string, std::string>, Histogram>& getHistograms();
+
+private:
+	static std::atomic<std::uint64_t> counters[COUNTER_COUNT];
+	static std::map<std::pair<std::string, std::string>, Histogram> histograms;
+};
+
+// Record the lifetime of the scope into a histogram.
+class Timing {
+public:
+	explicit Timing(Histogram& histogram) : histogram(histogram), start(Metrics::now()) { }
+	~Timing() { this->histogram.record(Metrics::now() - this->start); }
+
+	Timing(Timing const &) = delete;
+	void operator=(Timing const &) = delete;
+
+private:
+	Histogram& histogram;
+	std::uint64_t start;
+};
@@ -1,39 +1,93 @@
 #include "place.h"
 
 #include "aspect.h"
+#include "zone.h"
+#include "server.h"
+#include "journal.h"
 
-Place::Place(
-	const Aspect& aspect,
-	bool walkable
-) :
-	Aspected(aspect),
-	walkable(walkable)
+Place::Place(class Zone * zone, std::size_t index) :
+	zone(zone),
+	index(index)
 { }
 
+bool Place::isValid() const {
+	return(this->zone != nullptr);
+}
+
+const Aspect& Place::getAspect() const {
+	return(this->zone->aspects[this->index]);
+}
+
+void Place::setAspect(const Aspect& aspect) {
+	this->zone->aspects[this->index] = aspect;
+}
+
 /* Walkable. */
 
 bool Place::isWalkable() const {
-	return(this->walkable);
+	return(this->zone->walkable[this->index]);
 }
 
 void Place::setWalkable() {
-	this->walkable = true;
+	this->zone->walkable[this->index] = true;
 }
 
 void Place::setNotWalkable() {
-	this->walkable = false;
+	this->zone->walkable[this->index] = false;
 }
 
 /* When Walked On. */
 
 const Script& Place::getWhenWalkedOn() const {
-	return(this->whenWalkOn);
+	const Script * script = this->zone->whenWalkOn.find(this->index);
+	return(script ? *script : Script::noValue);
 }
 
 void Place::setWhenWalkedOn(const Script script) {
-	this->whenWalkOn = script;
+	if(script == Script::noValue) {
+		this->zone->whenWalkOn.erase(this->index);
+	} else {
+		this->zone->whenWalkOn.insert(this->index, script);
+	}
 }
 
 void Place::resetWhenWalkedOn() {
-	this->whenWalkOn = Script{};
+	this->zone->whenWalkOn.erase(this->index);
+}
+
+/* Tags */
+
+const TagValue& Place::getTag(const TagID& id) {
+	Tagged * tags = this->zone->tags.find(this->index);
+	return(tags ? tags->getTag(id) : TagValue::noValue);
+}
+
+void Place::setTag(const TagID& id, const TagValue& value) {
+	Tagged * tags = this->zone->tags.find(this->index);
+	if(tags == nullptr) {
+		tags = &this->zone->tags.insert(this->index, Tagged{});
+	}
+	tags->setTag(id, value);
+	class Journal * journal = this->zone->getServer()->getJournal();
+	if(journal) {
+		int x, y;
+		this->zone->position(this->index, x, y);
+		journal->setPlaceTag(this->zone->getId(), x, y, id, value);
+	}
+}
+
+void Place::delTag(const TagID& id) {
+	Tagged * tags = this->zone->tags.find(this->index);
+	if(tags != nullptr) {
+		tags->delTag(id);
+		if(not tags->hasTags()) {
+			this->zone->tags.erase(this->index);
+		}
+	}
+	class Journal * journal = this->zone->getServer()->getJournal();
+	if(journal) {
+		int x, y;
+		this->zone->position(this->index, x, y);
+		journal->delPlaceTag(this->zone->getId(), x, y, id);
+	}
 }
@@ -4,13 +4,21 @@
 #include "script.h"
 #include "tag.h"
 
-class Place : public Tagged, public Aspected {
+#include <cstddef>
+
+class Zone;
+
+// View on a place of a zone. Places aren't objects: the zone stores their
+// aspects and walkability in dense arrays, their scripts and tags aside.
+class Place {
 public:
 	Place() = delete;
-	Place(
-		const Aspect& aspect,
-		bool walkable = true
-	);
+	Place(class Zone * zone, std::size_t index); // nullptr zone: invalid place.
+
+	bool isValid() const;
+
+	const Aspect& getAspect() const;
+	void setAspect(const Aspect& aspect); // See Zone::updatePlaceAspect().
 
 	/* Walkable. */
 	bool isWalkable() const;
@@ -22,7 +30,12 @@ public:
 	void setWhenWalkedOn(const Script script);
 	void resetWhenWalkedOn();
 
+	/* Tags */
+	const TagValue& getTag(const TagID& id);
+	void setTag(const TagID& id, const TagValue& value);
+	void delTag(const TagID& id);
+
 private:
-	bool walkable;        // Can a character walk here?
-	Script whenWalkOn {}; // Script triggered when a character walks here.
+	class Zone * zone;
+	std::size_t index; // In the zone's arrays.
 };
@@ -5,8 +5,14 @@
 #include "zone.h"
 #include "place.h"
 #include "log.h"
+#include "metrics.h"
 
 #include <unistd.h>
+#include <sys/uio.h> // writev()
+#include <climits> // IOV_MAX
+#include <cstring> // memmove()
+#include <cstdlib> // atoi()
+#include <algorithm> // std::min(), std::max()
 
 // PUBLIC
 
@@ -18,22 +24,105 @@ Player::Player(int fd, class Character* character) :
 Player::~Player() {
 	info("Player "+std::to_string(this->fd)+" deleted.");
 	close(this->fd);
+	this->clearFloor();
 	this->character->setPlayer(nullptr);
 	// For now, the disconnection of a player kills the character. Later, a reconnection feature might be interesting.
 	this->character->getZone()->getServer()->delCharacter(this->character->getId());
 }
 
 void Player::check_action() {
-	std::string msg = this->receive();
-	if(msg != "") {
-		this->parse(msg);
+	if(not this->receive()) {
+		return;
 	}
+
+	// Parse every complete line.
+	std::size_t start = 0;
+	for(std::size_t i = 0; i < this->input_length and not this->_delme; i++) {
+		if(this->input[i] == '\n') {
+			if(i > start and not this->discarding) {
+				this->parse(std::string(this->input + start, i - start));
+			}
+			this->discarding = false;
+			start = i + 1;
+		}
+	}
+
+	if(start == 0 and this->input_length == PLAYER_INPUT_SIZE) {
+		// Skip the rest of the line too, up to its newline.
+		if(not this->discarding) {
+			warning("Player "+std::to_string(this->fd)+" sent a too long line: dropped.");
+		}
+		this->discarding = true;
+		start = this->input_length;
+	}
+
+	// Keep the partial line for the next call.
+	this->input_length -= start;
+	memmove(this->input, this->input + start, this->input_length);
 }
 
 bool Player::delme() {
 	return(this->_delme);
 }
 
+bool Player::flush() {
+	while(not this->output.empty()) {
+		struct iovec iov[IOV_MAX];
+		int count = 0;
+		std::size_t length = 0;
+		for(auto it = this->output.begin(); it != this->output.end() and count < IOV_MAX; it++) {
+			iov[count].iov_base = const_cast<char*>(it->data());
+			iov[count].iov_len = it->length();
+			length += it->length();
+			count++;
+		}
+		iov[0].iov_base = static_cast<char*>(iov[0].iov_base) + this->output_offset;
+		iov[0].iov_len -= this->output_offset;
+		length -= this->output_offset;
+
+		ssize_t written = writev(this->fd, iov, count);
+		if(written == -1) {
+			if(errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR) {
+				this->_delme = true;
+				this->output.clear();
+				this->output_size = 0;
+				this->output_offset = 0;
+			}
+			break;
+		}
+
+		// Pop what has been fully written.
+		Metrics::count(COUNTER_BYTES, written);
+		this->output_size -= written;
+		std::size_t done = this->output_offset + written;
+		while(not this->output.empty() and done >= this->output.front().length()) {
+			done -= this->output.front().length();
+			this->output.pop_front();
+		}
+		this->output_offset = done;
+
+		if((std::size_t) written < length) {
+			break; // Socket buffer is full.
+		}
+	}
+	this->stalled = not this->output.empty();
+	return(not this->stalled);
+}
+
+bool Player::isStalled() {
+	return(this->stalled);
+}
+
+std::size_t Player::output_limit = PLAYER_OUTPUT_LIMIT;
+
+void Player::setOutputLimit(std::size_t limit) {
+	Player::output_limit = limit;
+}
+
+std::size_t Player::getOutputLimit() {
+	return(Player::output_limit);
+}
+
 void Player::message(std::string message) {
 	this->send("msg " + message);
 }
@@ -50,6 +139,9 @@ void Player::updateCharacter(class Character * character) {
 			+ " "
 			+ std::to_string(character->getY())
 		  );
+	if(character == this->character and this->protocol >= 3) {
+		this->streamFloor();
+	}
 }
 
 void Player::updateCharacterExit(class Character * character) {
@@ -69,18 +161,25 @@ void Player::updateFloor() {
 		  );
 
 	// Send places' aspects.
-	std::string toSend = "";
-	for(unsigned int y=0; y<this->character->getZone()->getHeight(); y++) {
-		for(unsigned int x=0; x<this->character->getZone()->getWidth(); x++) {
-			toSend += std::to_string(this->character->getZone()->getPlace(x, y)->getAspect().toEntry());
-			toSend += ",";
-		}
+	this->clearFloor();
+	if(this->protocol >= 3) {
+		// Chunks are streamed around the character once it is placed.
+		class Zone * zone = this->character->getZone();
+		this->chunks.resize(zone->getChunksWidth() * zone->getChunksHeight(), false);
+	} else {
+		this->send(this->character->getZone()->getFloor(this->protocol));
 	}
-	toSend.pop_back();
-	this->send(toSend);
 }
 
 void Player::updateFloor(unsigned int x, unsigned int y, const Aspect& aspect) {
+	if(this->protocol >= 3) {
+		// The chunk will be up to date when sent.
+		class Zone * zone = this->character->getZone();
+		unsigned int chunk_id = zone->getChunkId(x, y);
+		if(chunk_id >= this->chunks.size() or not this->chunks[chunk_id]) {
+			return;
+		}
+	}
 	// floorchange <aspect> <X> <Y>
 	this->send(
 			"floorchange "
@@ -92,6 +191,49 @@ void Player::updateFloor(unsigned int x, unsigned int y, const Aspect& aspect) {
 		  );
 }
 
+void Player::updateFloorRegion(unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+	class Zone * zone = this->character->getZone();
+	if(this->protocol < 3) {
+		// One message of "floorchange" lines: the region only, no zone header.
+		std::string batch;
+		for(unsigned int j = y; j < y + h; j++) {
+			for(unsigned int i = x; i < x + w; i++) {
+				if(not batch.empty()) {
+					batch.push_back('\n');
+				}
+				batch += "floorchange "
+					+ std::to_string(zone->getPlace(i, j).getAspect().toEntry())
+					+ " "
+					+ std::to_string(i)
+					+ " "
+					+ std::to_string(j);
+			}
+		}
+		this->send(batch);
+		return;
+	}
+	for(unsigned int cy = y / ZONE_CHUNK_SIZE; cy <= (y + h - 1) / ZONE_CHUNK_SIZE; cy++) {
+		for(unsigned int cx = x / ZONE_CHUNK_SIZE; cx <= (x + w - 1) / ZONE_CHUNK_SIZE; cx++) {
+			unsigned int chunk_id = cy * zone->getChunksWidth() + cx;
+			if(chunk_id < this->chunks.size() and this->chunks[chunk_id]) {
+				this->send(zone->getChunk(cx, cy));
+			}
+		}
+	}
+}
+
+void Player::clearFloor() {
+	class Zone * zone = this->character->getZone();
+	if(zone) {
+		for(unsigned int i = 0; i < this->chunks.size(); i++) {
+			if(this->chunks[i]) {
+				zone->releaseChunk(i);
+			}
+		}
+	}
+	this->chunks.clear();
+}
+
 void Player::updateGauge(
 	std::string name,
 	unsigned int val,
@@ -171,27 +313,61 @@ void Player::hint(Aspect aspect, std::string hint) {
 // PRIVATE
 
 void Player::send(std::string message) {
-	if(this->fd) {
-		std::string toSend = message + "\n";
-		write(this->fd, toSend.c_str(), toSend.length());
-		// this->socket << message << std::endl;
+	if(this->fd and not this->_delme) {
+		message.push_back('\n');
+		Metrics::count(COUNTER_MESSAGES);
+		this->output_size += message.length();
+		this->output.push_back(std::move(message));
+
+		if(this->output_size > Player::output_limit) {
+			warning("Player "+std::to_string(this->fd)+" doesn't read its messages: disconnected.");
+			this->_delme = true;
+			this->output.clear();
+			this->output_size = 0;
+			this->output_offset = 0;
+		}
 	}
 }
 
-std::string Player::receive() {
-	std::string msg = "";
-	char c;
-	int flag;
-	flag = read(this->fd, &c, 1);
-	while(flag > 0 and c != '\n') {
-		msg.push_back(c);
-		flag = read(this->fd, &c, 1);
+void Player::streamFloor() {
+	class Zone * zone = this->character->getZone();
+	int x = this->character->getX();
+	int y = this->character->getY();
+	if(zone == nullptr or this->chunks.empty() or not zone->isPlaceValid(x, y)) {
+		return;
+	}
+
+	int cx_min = std::max(x / ZONE_CHUNK_SIZE - ZONE_CHUNK_VIEW, 0);
+	int cy_min = std::max(y / ZONE_CHUNK_SIZE - ZONE_CHUNK_VIEW, 0);
+	int cx_max = std::min(x / ZONE_CHUNK_SIZE + ZONE_CHUNK_VIEW, (int) zone->getChunksWidth() - 1);
+	int cy_max = std::min(y / ZONE_CHUNK_SIZE + ZONE_CHUNK_VIEW, (int) zone->getChunksHeight() - 1);
+	for(int cy = cy_min; cy <= cy_max; cy++) {
+		for(int cx = cx_min; cx <= cx_max; cx++) {
+			unsigned int chunk_id = cy * zone->getChunksWidth() + cx;
+			if(not this->chunks[chunk_id]) {
+				this->send(zone->getChunk(cx, cy));
+				zone->holdChunk(chunk_id);
+				this->chunks[chunk_id] = true;
+			}
+		}
 	}
+}
+
+bool Player::receive() {
+	ssize_t flag = read(
+		this->fd,
+		this->input + this->input_length,
+		PLAYER_INPUT_SIZE - this->input_length
+	);
 	// EAGAIN and EWOULDBLOCK are "errors" when nothing is available on a non-blocking socket.
 	if(flag == 0 or (flag == -1 and errno != EAGAIN and errno != EWOULDBLOCK)) {
 		this->_delme = true;
 	}
-	return(msg);
+	if(flag <= 0) {
+		return(false);
+	}
+	this->input_length += flag;
+	return(true);
 }
 
 void Player::parse(std::string msg) {
@@ -234,6 +410,19 @@ void Player::parse(std::string msg) {
 		if(this->character->getZone()) {
 			this->character->getZone()->event(this->character->getName().toString()+": "+arg);
 		}
+	} else if(cmd == "protocol") {
+		// protocol <version> : switch encoding and resend the floor with it.
+		unsigned int version = std::atoi(arg.c_str());
+		if(version >= 1 and version <= PROTOCOL_VERSION) {
+			this->protocol = version;
+			if(this->character->getZone()) {
+				this->updateFloor();
+				this->streamFloor();
+			}
+		}
+	} else if(cmd == "ping") {
+		// ping <token> : answered after the effects of the previous lines.
+		this->send("pong " + arg);
 	} else if(cmd == "quit") {
 		this->_delme = true;
 	}
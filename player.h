@@ -3,6 +3,14 @@
 #include "aspect.h"
 
 #include <thread>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define PLAYER_INPUT_SIZE 4096 // Longest accepted line.
+#define PLAYER_OUTPUT_LIMIT (4*1024*1024) // Default high-water mark, in bytes.
+#define PROTOCOL_VERSION 3 // Latest protocol; clients start at 1 and ask for more.
 
 class Character;
 
@@ -14,12 +22,23 @@ public:
 	void check_action();
 	bool delme();
 
+	// Write queued messages. Return false if some are still pending.
+	bool flush();
+	bool isStalled(); // Is the client not reading fast enough?
+
+	// Clients with more unsent bytes than this are disconnected.
+	static void setOutputLimit(std::size_t limit);
+	static std::size_t getOutputLimit();
+
 	/* Send messages to client */
 	void message(std::string message);
 	void updateCharacter(class Character * character);
 	void updateCharacterExit(class Character * character);
 	void updateFloor();
 	void updateFloor(unsigned int x, unsigned int y, const Aspect& aspect);
+	// Resend the held chunks of the region, or its places in one batch before protocol 3.
+	void updateFloorRegion(unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+	void clearFloor(); // Forget the chunks sent from the current zone.
 	void updateGauge(
 		std::string name,
 		unsigned int val,
@@ -39,8 +58,24 @@ private:
 	int fd;
 	class Character* character;
 	bool _delme = false;
+	unsigned int protocol = 1;
+	std::vector<bool> chunks; // Chunks of the zone sent (protocol 3).
+
+	/* Input buffer: lines are parsed once complete, partial ones are kept. */
+	char input[PLAYER_INPUT_SIZE];
+	std::size_t input_length = 0;
+	bool discarding = false; // In a too long line.
+
+	/* Output queue: flushed with writev() once per loop. */
+	std::deque<std::string> output;
+	std::size_t output_offset = 0; // Already written bytes of output.front().
+	std::size_t output_size = 0;   // Unsent bytes.
+	bool stalled = false;
+
+	static std::size_t output_limit;
 
 	void send(std::string message);
-	std::string receive();
+	void streamFloor(); // Send the missing chunks around the character.
+	bool receive(); // Append available data to the input buffer with one read().
 	void parse(std::string message);
 };
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#define REGISTRY_MIN_CAPACITY 16 // Slots of an empty registry, a power of 2.
+
+// Flat hash table. Entries are stored contiguously and found through an
+// open-addressing index: linear probing, backward shift deletion (no
+// tombstones), at most half full.
+// Lookups never insert. Inserting or erasing may move entries: values
+// meant to be kept (Zone, Character...) are stored as pointers.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class Registry {
+public:
+	typedef std::pair<Key, Value> Entry;
+
+	Registry() : index(REGISTRY_MIN_CAPACITY, EMPTY) { }
+
+	Value * find(const Key& key) { // May return nullptr.
+		std::uint32_t i = this->index[this->probe(key)];
+		return(i == EMPTY ? nullptr : &this->entries[i].second);
+	}
+
+	// Insert or replace.
+	Value& insert(const Key& key, Value value) {
+		std::size_t slot = this->probe(key);
+		if(this->index[slot] != EMPTY) {
+			Value& old = this->entries[this->index[slot]].second;
+			old = std::move(value);
+			return(old);
+		}
+		if((this->entries.size() + 1) * 2 > this->index.size()) {
+			this->grow();
+			slot = this->probe(key);
+		}
+		this->index[slot] = this->entries.size();
+		this->entries.emplace_back(key, std::move(value));
+		return(this->entries.back().second);
+	}
+
+	bool erase(const Key& key) { // False if not found.
+		std::size_t mask = this->index.size() - 1;
+		std::size_t hole = this->probe(key);
+		std::uint32_t i = this->index[hole];
+		if(i == EMPTY) {
+			return(false);
+		}
+
+		// Pull back the following slots of the cluster that may fill the hole.
+		for(std::size_t next = (hole + 1) & mask; this->index[next] != EMPTY; next = (next + 1) & mask) {
+			std::size_t home = Hash{}(this->entries[this->index[next]].first) & mask;
+			if(((next - home) & mask) >= ((next - hole) & mask)) {
+				this->index[hole] = this->index[next];
+				hole = next;
+			}
+		}
+		this->index[hole] = EMPTY;
+
+		// Keep entries contiguous: the last one takes the erased place.
+		std::uint32_t last = this->entries.size() - 1;
+		if(i != last) {
+			std::size_t slot = Hash{}(this->entries[last].first) & mask;
+			while(this->index[slot] != last) {
+				slot = (slot + 1) & mask;
+			}
+			this->index[slot] = i;
+			this->entries[i] = std::move(this->entries[last]);
+		}
+		this->entries.pop_back();
+		return(true);
+	}
+
+	std::size_t size() const { return(this->entries.size()); }
+	bool empty() const { return(this->entries.empty()); }
+
+	typename std::vector<Entry>::iterator begin() { return(this->entries.begin()); }
+	typename std::vector<Entry>::iterator end() { return(this->entries.end()); }
+
+private:
+	enum : std::uint32_t { EMPTY = UINT32_MAX };
+
+	std::vector<Entry> entries;
+	std::vector<std::uint32_t> index; // Entry of each slot, or EMPTY.
+
+	// Slot of the key, or the empty slot ending its cluster.
+	std::size_t probe(const Key& key) const {
+		std::size_t mask = this->index.size() - 1;
+		std::size_t slot = Hash{}(key) & mask;
+		while(this->index[slot] != EMPTY and not (this->entries[this->index[slot]].first == key)) {
+			slot = (slot + 1) & mask;
+		}
+		return(slot);
+	}
+
+	void grow() {
+		this->index.assign(this->index.size() * 2, EMPTY);
+		std::size_t mask = this->index.size() - 1;
+		for(std::uint32_t i = 0; i < this->entries.size(); i++) {
+			std::size_t slot = Hash{}(this->entries[i].first) & mask;
+			while(this->index[slot] != EMPTY) {
+				slot = (slot + 1) & mask;
+			}
+			this->index[slot] = i;
+		}
+	}
+};
@@ -10,8 +10,15 @@ bool Script::operator < (const Script& rhs) const {
 	return(this->data < rhs.data);
 }
 
-void Script::execute(Luawrapper& lua, Character * character, std::string arg) const {
-	lua.executeCode(this->data, character, arg);
+void Script::execute(Luawrapper& lua, Character * character, std::string arg, Trigger trigger) const {
+	if(this->data.empty()) {
+		return;
+	}
+	if(this->compiled_by != &lua or this->chunk == nullptr or this->chunk->ref == LUA_NOREF) {
+		this->chunk = lua.compile(this->data);
+		this->compiled_by = &lua;
+	}
+	lua.executeChunk(this->chunk, character, arg, trigger);
 }
 
 const std::string& Script::toString() const {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <memory>
 
 #include "luawrapper.h"
 
@@ -12,10 +13,14 @@ public:
 	bool operator != (const Script& rhs) const { return(not (*this == rhs) ); }
 	bool operator < (const Script& rhs) const;
 
-	void execute(Luawrapper& lua, Character * character = nullptr, std::string arg = "") const;
+	void execute(Luawrapper& lua, Character * character = nullptr, std::string arg = "", Trigger trigger = TRIGGER_OTHER) const;
 	const std::string& toString() const;
 
 	static Script noValue;
 private:
 	std::string data;
+
+	// Compiled function, resolved on first execution and again once evicted.
+	mutable const Luawrapper * compiled_by = nullptr;
+	mutable std::shared_ptr<struct Luawrapper::Chunk> chunk;
 };
@@ -6,15 +6,25 @@
 #include "luawrapper.h"
 #include "log.h"
 #include "inventory.h"
+#include "gauge.h"
+#include "binary.h"
+#include "journal.h"
+#include "metrics.h"
 
 #include <unistd.h> // close()
 #include <sys/socket.h> // socket(), bind(), listen()
 #include <netinet/in.h> // IPv4, IPv6
 #include <arpa/inet.h> // inet_ntoa()
 #include <fcntl.h> // fcntl()
+#include <sys/epoll.h> // epoll_create1(), epoll_ctl(), epoll_wait()
+#include <sys/timerfd.h> // timerfd_create(), timerfd_settime()
+#include <sys/wait.h> // waitpid()
 
-#include <thread> // std::this_thread::sleep_for()
-#include <chrono> // std::chrono::milliseconds
+#include <cstdint> // uint64_t
+#include <climits> // ULONG_MAX
+#include <algorithm> // std::max()
+#include <cstring> // memcmp()
+#include <cstdio> // snprintf()
 
 #include <iostream>
 
@@ -22,23 +32,66 @@ const int console = 0; // File descriptor.
 
 /* Public */
 
-Server::Server() {
-	this->luawrapper = new Luawrapper(this);
-	fcntl(console, F_SETFL, fcntl(console, F_GETFL) | O_NONBLOCK); // Make console non-blocking.
+Server::Server(bool interactive) :
+	connexion_fd(-1),
+	port(0)
+{
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(this->epoll_fd == -1) {
+		fatal("Unable to create epoll instance");
+	}
+
+	// Timers are stepped when one is due, see armTimer(): an idle server sleeps.
+	this->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(this->timer_fd == -1) {
+		fatal("Unable to create timer");
+	}
+	this->timer_origin = Metrics::now();
+	this->watch(this->timer_fd);
+	this->timer_wheel.resize(TIMER_WHEEL_LEVELS << TIMER_WHEEL_BITS);
+
+	if(interactive) {
+		fcntl(console, F_SETFL, fcntl(console, F_GETFL) | O_NONBLOCK); // Make console non-blocking.
+		struct epoll_event event {};
+		event.events = EPOLLIN;
+		event.data.fd = console;
+		// Regular files and /dev/null can't be polled (EPERM): run without console.
+		epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, console, &event);
+	}
+
+	this->luawrapper = new Luawrapper(this, "", interactive ? LUA_INIT_SCRIPT : "");
 }
 
 Server::~Server() {
 	if(this->isOpen()) {
 		this->_close();
 	}
+	if(this->metrics_fd != -1) {
+		close(this->metrics_fd);
+	}
+	for(auto& it : this->scrapers) {
+		close(it.first);
+	}
+
+	for(auto& it : this->zones) {
+		delete(it.second);
+	}
 
-	for(std::pair<std::string, Zone*> it : this->zones) {
+	// After the zones: their characters' scripts may still run.
+	for(auto& it : this->resumes) {
+		it.first->release(it.second);
+	}
+	for(auto& it : this->vms) {
 		delete(it.second);
 	}
+
+	delete(this->journal);
+	close(this->timer_fd);
+	close(this->epoll_fd);
 }
 
 void Server::_open(unsigned short port, const std::string& spawn_z, unsigned int spawn_x, unsigned int spawn_y) {
-	if(this->connexion_fd != 0) {
+	if(this->connexion_fd != -1) {
 		this->_close();
 	}
 	this->port = port;
@@ -73,6 +126,7 @@ void Server::_open(unsigned short port, const std::string& spawn_z, unsigned int
 	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK); // Make non-blocking.
 
 	this->connexion_fd = sockfd;
+	this->watch(sockfd);
 
 	this->spawn_zone = spawn_z;
 	this->spawn_x = spawn_x;
@@ -86,15 +140,16 @@ void Server::_open(unsigned short port, const std::string& spawn_z, unsigned int
 }
 
 void Server::_close() {
+	this->unwatch(this->connexion_fd);
 	close(this->connexion_fd);
-	this->connexion_fd = 0;
+	this->connexion_fd = -1;
 	this->port = 0;
 
 	info("Server closed.");
 }
 
 bool Server::isOpen() {
-	return(this->connexion_fd != 0);
+	return(this->connexion_fd != -1);
 }
 
 unsigned short Server::getPort() {
@@ -111,40 +166,39 @@ void Server::addZone(std::string id, class Zone * zone) {
 		this->delZone(id);
 		info("Zone '"+id+"' replaced.");
 	}
-	this->zones[id] = zone;
+	this->zones.insert(id, zone);
 }
 
 class Zone * Server::getZone(std::string id) {
-	return(this->zones[id]);
+	class Zone ** zone = this->zones.find(id);
+	return(zone ? *zone : nullptr);
 }
 
 void Server::delZone(std::string id) {
-	if(this->zones[id] != nullptr) {
-		delete(this->zones[id]);
+	class Zone * zone = this->getZone(id);
+	if(zone != nullptr) {
+		delete(zone);
 		this->zones.erase(id);
 	}
 }
 
 void Server::addCharacter(class Character * character) {
 	Uuid id = character->getId();
-	if(this->characters[id] != nullptr) {
+	class Character * old = this->getCharacter(id);
+	if(old != nullptr) {
 		warning("Character '"+id.toString()+"' replaced.");
-		delete(this->characters[id]);
+		delete(old);
 	}
-	this->characters[id] = character;
+	this->characters.insert(id, character);
 }
 
 class Character * Server::getCharacter(Uuid id) {
-	class Character * character = this->characters[id];
-	if(character == nullptr) {
-		return(nullptr);
-	} else {
-		return(character);
-	}
+	class Character ** character = this->characters.find(id);
+	return(character ? *character : nullptr);
 }
 
 void Server::delCharacter(Uuid id) {
-	class Character * character = this->characters[id];
+	class Character * character = this->getCharacter(id);
 	if(character == nullptr) {
 		info("Character '"+id.toString()+"' can't be deleted: doesn't exist.");
 	} else {
@@ -182,7 +236,8 @@ void Server::delAction(std::string trigger) {
 
 void Server::doAction(std::string trigger, class Character& character, std::string arg) {
 	try {
-		this->actions.at(trigger).execute(*(this->luawrapper), &character, arg);
+		class Luawrapper * lua = character.getZone() ? character.getZone()->getLua() : this->luawrapper;
+		this->actions.at(trigger).execute(*lua, &character, arg, TRIGGER_ACTION);
 	} catch (const std::out_of_range& oor) {
 		info("Action '"+trigger+"' doesn't exist.");
 	}
@@ -191,107 +246,581 @@ void Server::doAction(std::string trigger, class Character& character, std::stri
 Uuid Server::newArtifact(Name name) {
 	Uuid id {};
 	Artifact* artifact = new Artifact(name);
-	this->artifacts[id] = artifact;
+	artifact->attach(this, id);
+	this->artifacts.insert(id, artifact);
+	if(this->journal) this->journal->newArtifact(id, name);
 	return(id);
 }
 
+void Server::addArtifact(Uuid id, class Artifact * artifact) {
+	delete(this->getArtifact(id));
+	artifact->attach(this, id);
+	this->artifacts.insert(id, artifact);
+}
+
 void Server::delArtifact(Uuid id) {
 	Artifact* artifact = this->getArtifact(id);
 	if(artifact != nullptr) {
 		delete(artifact);
+		if(this->journal) this->journal->delArtifact(id);
 	}
 	this->artifacts.erase(id);
 }
 
 class Artifact* Server::getArtifact(Uuid id) {
-	try {
-		return(this->artifacts.at(id));
-	} catch(const std::out_of_range& oor) {
-		return(nullptr);
-	}
+	class Artifact ** artifact = this->artifacts.find(id);
+	return(artifact ? *artifact : nullptr);
 }
 
 Uuid Server::newInventory(unsigned int size) {
 	Uuid id {};
 	Inventory* inventory = new Inventory(size);
-	this->inventories[id] = inventory;
+	inventory->attach(this, id);
+	this->inventories.insert(id, inventory);
+	if(this->journal) this->journal->newInventory(id, size);
 	return(id);
 }
 
+void Server::addInventory(Uuid id, class Inventory * inventory) {
+	delete(this->getInventory(id));
+	inventory->attach(this, id);
+	this->inventories.insert(id, inventory);
+}
+
 void Server::delInventory(Uuid id) {
 	Inventory* inventory = this->getInventory(id);
 	if(inventory != nullptr) {
 		delete(inventory);
+		if(this->journal) this->journal->delInventory(id);
 	}
 	this->inventories.erase(id);
 }
 
 class Inventory* Server::getInventory(Uuid id) {
-	try {
-		return(this->inventories.at(id));
-	} catch(...) {
-		return(nullptr);
-	}
+	class Inventory ** inventory = this->inventories.find(id);
+	return(inventory ? *inventory : nullptr);
 }
 
-Uuid Server::addTimer(unsigned int duration, const Script& script) {
+Uuid Server::addTimer(unsigned long duration, const Script& script, class Luawrapper * lua) {
 	Uuid id {};
-	this->timers.emplace(id, Timer{duration, script});
+	// Rounded up to the next tick, at least one tick.
+	unsigned long ticks = std::max((duration + TIMER_TICK - 1) / TIMER_TICK, 1ul);
+	struct Timer& timer = this->timers.insert(id, Timer{this->currentTick() + ticks, script, lua ? lua : this->luawrapper, LUA_NOREF, nullptr, {}});
+	this->scheduleTimer(id, timer);
 	return(id);
 }
 
+void Server::addWait(unsigned long duration, class Luawrapper * lua, int thread) {
+	Uuid id = this->addTimer(duration, Script::noValue, lua);
+	this->timers.find(id)->thread = thread;
+}
+
+void Server::resumeLater(class Luawrapper * lua, int thread) {
+	this->resumes.emplace_back(lua, thread);
+}
+
 void Server::delTimer(Uuid id) {
-	this->timers.erase(id);
+	struct Timer * timer = this->timers.find(id);
+	if(timer != nullptr) {
+		this->unscheduleTimer(*timer);
+		if(timer->thread != LUA_NOREF) {
+			timer->lua->release(timer->thread);
+		}
+		this->timers.erase(id);
+	}
 }
 
 void Server::triggerTimer(Uuid id) {
-	auto it = this->timers.find(id);
-	if(it == this->timers.end()) {
+	struct Timer * timer = this->timers.find(id);
+	if(timer == nullptr) {
 		warning("Cannot trigger timer: id not found.");
 		return;
 	}
-	it->second.script.execute(*luawrapper);
-	this->timers.erase(it);
+	this->unscheduleTimer(*timer);
+	this->fireTimer(id, *timer);
 }
 
-unsigned int Server::getTimerRemaining(Uuid id) {
-	auto it = this->timers.find(id);
-	if(it == this->timers.end()) {
+unsigned long Server::getTimerRemaining(Uuid id) {
+	struct Timer * timer = this->timers.find(id);
+	if(timer == nullptr) {
 		return(0);
 	}
-	return(it->second.remaining);
+	unsigned long now = this->currentTick();
+	return(timer->expiry > now ? (timer->expiry - now) * TIMER_TICK : 1); // Due: fired this loop.
 }
 
-void Server::setTimerRemaining(Uuid id, unsigned int remaining) {
+void Server::setTimerRemaining(Uuid id, unsigned long remaining) {
 	if(remaining == 0) {
 		this->triggerTimer(id);
 		return;
 	}
-	auto it = this->timers.find(id);
-	if(it == this->timers.end()) {
+	struct Timer * timer = this->timers.find(id);
+	if(timer == nullptr) {
 		warning("Cannot set timer's remaining time: id not found.");
 		return;
 	}
-	it->second.remaining = remaining;
+	this->unscheduleTimer(*timer);
+	timer->expiry = this->currentTick() + (remaining + TIMER_TICK - 1) / TIMER_TICK;
+	this->scheduleTimer(id, *timer);
+}
+
+static void putTags(BinaryWriter& file, Tagged& tagged) {
+	file.put32(tagged.getTags().size());
+	for(auto& tag : tagged.getTags()) {
+		file.putString(tag.first.toString());
+		file.putString(tag.second.toString());
+	}
+}
+
+static void getTags(BinaryReader& file, Tagged& tagged) {
+	std::uint32_t count = file.get32();
+	for(std::uint32_t i = 0; i < count and file.isValid(); i++) {
+		TagID id { file.getString() };
+		TagValue value { file.getString() };
+		tagged.setTag(id, value);
+	}
+}
+
+bool Server::saveSnapshot(const std::string& filename) {
+	if(this->snapshot_pid > 0) {
+		warning("A snapshot is already being written.");
+		return(false);
+	}
+	pid_t pid = fork();
+	if(pid == -1) {
+		warning("Unable to fork to write a snapshot.");
+		return(false);
+	}
+	if(pid == 0) {
+		// The child sees the world as it was at fork(): write it and leave
+		// without running any destructor.
+		BinaryWriter file;
+		this->writeSnapshot(file);
+		_exit(file.save(filename) ? 0 : 1);
+	}
+	this->snapshot_pid = pid;
+	// Records until now are in the snapshot, if it succeeds.
+	this->snapshot_journaled = this->journal != nullptr;
+	if(this->journal) this->journal->rotate();
+	return(true);
+}
+
+/* Snapshot file, native byte order:
+ * magic "HKSN", version 32, last id 64, journal sequence 64,
+ * timers: count 32, then id 64, remaining milliseconds 64, script, VM name,
+ * artifacts: count 32, then id 64, name, tags,
+ * inventories: count 32, then id 64, size 32, count 32, (item, quantity 32)...
+ * places: count of zones 32, then zone id, tags of places as in zone files,
+ * characters (without players): count 32, then id 64, name, aspect, zone id, x 32, y 32,
+ *   ghost 8, when death, tags, gauges: count 32, then name, val 32, max 32,
+ *   full aspect, empty aspect, when full, when empty, visible 8.
+ * Tags are a count 32 then (id, value)... Strings are a length 32 then bytes. */
+
+void Server::writeSnapshot(class BinaryWriter& file) {
+	file.putBytes(SNAPSHOT_FILE_MAGIC, 4);
+	file.put32(SNAPSHOT_FILE_VERSION);
+	file.put64(Uuid{}.toInteger()); // Only the child's counter moves.
+	file.put64(this->journal ? this->journal->getSequence() : 0);
+
+	// Waiting coroutines can't be saved: their scripts are lost.
+	std::uint32_t timers = 0;
+	for(auto& it : this->timers) {
+		timers += it.second.thread == LUA_NOREF;
+	}
+	file.put32(timers);
+	unsigned long now = this->currentTick();
+	for(auto& it : this->timers) {
+		if(it.second.thread != LUA_NOREF) {
+			continue;
+		}
+		file.put64(it.first.toInteger());
+		file.put64(it.second.expiry > now ? (it.second.expiry - now) * TIMER_TICK : 0);
+		file.putString(it.second.script.toString());
+		file.putString(it.second.lua->getName());
+	}
+
+	file.put32(this->artifacts.size());
+	for(auto& it : this->artifacts) {
+		file.put64(it.first.toInteger());
+		file.putString(it.second->getName().toString());
+		putTags(file, *it.second);
+	}
+
+	file.put32(this->inventories.size());
+	for(auto& it : this->inventories) {
+		file.put64(it.first.toInteger());
+		file.put32(it.second->size());
+		std::vector<std::string> items = it.second->get_all();
+		file.put32(items.size());
+		for(const std::string& item : items) {
+			file.putString(item);
+			file.put32(it.second->get(item));
+		}
+	}
+
+	file.put32(this->zones.size());
+	for(auto& it : this->zones) {
+		file.putString(it.first);
+		it.second->saveTags(file);
+	}
+
+	// Players log in again: theirs would come back as orphans.
+	std::uint32_t characters = 0;
+	for(auto& it : this->characters) {
+		characters += it.second->getPlayer() == nullptr;
+	}
+	file.put32(characters);
+	for(auto& it : this->characters) {
+		class Character * character = it.second;
+		if(character->getPlayer() != nullptr) {
+			continue;
+		}
+		file.put64(it.first.toInteger());
+		file.putString(character->getName().toString());
+		file.putString(character->getAspect().toString());
+		file.putString(character->getZone() ? character->getZone()->getId() : "");
+		file.put32(character->getX());
+		file.put32(character->getY());
+		file.put8(character->isGhost());
+		file.putString(character->getWhenDeath().toString());
+		putTags(file, *character);
+		file.put32(character->getGauges().size());
+		for(auto& gauge : character->getGauges()) {
+			file.putString(gauge.first);
+			file.put32(gauge.second->getVal());
+			file.put32(gauge.second->getMax());
+			file.putString(gauge.second->getAspectFull().toString());
+			file.putString(gauge.second->getAspectEmpty().toString());
+			file.putString(gauge.second->getWhenFull().toString());
+			file.putString(gauge.second->getWhenEmpty().toString());
+			file.put8(gauge.second->isVisible());
+		}
+	}
+}
+
+bool Server::loadSnapshot(const std::string& filename) {
+	if(this->journal) {
+		warning("Snapshots must be loaded before the journal is opened.");
+		return(false);
+	}
+	BinaryReader file { filename };
+	if(not file.isOpen()) {
+		warning("Unable to open snapshot '"+filename+"'.");
+		return(false);
+	}
+	const char * magic = file.getBytes(4);
+	if(magic == nullptr or memcmp(magic, SNAPSHOT_FILE_MAGIC, 4) != 0 or file.get32() != SNAPSHOT_FILE_VERSION) {
+		warning("'"+filename+"' isn't a snapshot of version "+std::to_string(SNAPSHOT_FILE_VERSION)+".");
+		return(false);
+	}
+	Uuid::fromInteger(file.get64()); // Restored or not, ids aren't given twice.
+	this->journal_sequence = file.get64();
+
+	std::uint32_t count = file.get32();
+	for(std::uint32_t i = 0; i < count and file.isValid(); i++) {
+		Uuid id = Uuid::fromInteger(file.get64());
+		unsigned long remaining = (file.get64() + TIMER_TICK - 1) / TIMER_TICK; // In ticks.
+		Script script { file.getString() };
+		std::string vm = file.getString();
+		if(file.isValid()) {
+			this->delTimer(id);
+			struct Timer& timer = this->timers.insert(id, Timer{this->currentTick() + std::max(remaining, 1ul), script, this->getLua(vm), LUA_NOREF, nullptr, {}});
+			this->scheduleTimer(id, timer);
+		}
+	}
+
+	count = file.get32();
+	for(std::uint32_t i = 0; i < count and file.isValid(); i++) {
+		Uuid id = Uuid::fromInteger(file.get64());
+		Artifact * artifact = new Artifact(Name { file.getString() });
+		getTags(file, *artifact);
+		this->addArtifact(id, artifact);
+	}
+
+	count = file.get32();
+	for(std::uint32_t i = 0; i < count and file.isValid(); i++) {
+		Uuid id = Uuid::fromInteger(file.get64());
+		Inventory * inventory = new Inventory(file.get32());
+		std::uint32_t items = file.get32();
+		for(std::uint32_t j = 0; j < items and file.isValid(); j++) {
+			std::string item = file.getString();
+			inventory->add_all(file.get32(), item);
+		}
+		this->addInventory(id, inventory);
+	}
+
+	count = file.get32();
+	for(std::uint32_t i = 0; i < count and file.isValid(); i++) {
+		std::string id = file.getString();
+		class Zone * zone = this->getZone(id);
+		if(zone != nullptr) {
+			zone->loadTags(file);
+		} else {
+			// Zone gone: skip its places.
+			Tagged ignored;
+			for(std::uint32_t places = file.get32(); places > 0 and file.isValid(); places--) {
+				file.get32();
+				file.get32();
+				getTags(file, ignored);
+			}
+		}
+	}
+
+	count = file.get32();
+	for(std::uint32_t i = 0; i < count and file.isValid(); i++) {
+		Uuid id = Uuid::fromInteger(file.get64());
+		Name name { file.getString() };
+		Aspect aspect { file.getString() };
+		class Character * character = new Character(id, name, aspect);
+		this->addCharacter(character);
+		class Zone * zone = this->getZone(file.getString());
+		int x = file.get32();
+		int y = file.get32();
+		if(file.get8()) {
+			character->setGhost();
+		}
+		character->setWhenDeath(Script { file.getString() });
+		getTags(file, *character);
+		std::uint32_t gauges = file.get32();
+		for(std::uint32_t j = 0; j < gauges and file.isValid(); j++) {
+			Name gauge_name { file.getString() };
+			unsigned int val = file.get32();
+			unsigned int max = file.get32();
+			Aspect full { file.getString() };
+			Aspect empty { file.getString() };
+			Script when_full { file.getString() };
+			Script when_empty { file.getString() };
+			bool visible = file.get8();
+			class Gauge * gauge = new Gauge(character, gauge_name, val, max, full, empty, visible);
+			gauge->setWhenFull(when_full);
+			gauge->setWhenEmpty(when_empty);
+		}
+		if(zone != nullptr) {
+			character->changeZone(zone, x, y);
+		}
+	}
+
+	if(not file.isValid()) {
+		warning("Snapshot '"+filename+"' is truncated: partially restored.");
+		return(false);
+	}
+	return(true);
+}
+
+bool Server::openJournal(const std::string& filename, unsigned int sync_interval) {
+	if(this->journal) {
+		warning("A journal is already open.");
+		return(false);
+	}
+	std::uint64_t sequence = Journal::replay(this, filename, this->journal_sequence);
+	if(sequence > this->journal_sequence) {
+		info("Journal replayed up to record "+std::to_string(sequence)+".");
+	}
+	this->journal = new Journal(filename, sync_interval, sequence);
+	if(not this->journal->isOpen()) {
+		delete(this->journal);
+		this->journal = nullptr;
+		return(false);
+	}
+	return(true);
+}
+
+class Journal * Server::getJournal() {
+	return(this->journal);
 }
 
 class Luawrapper * Server::getLua() {
 	return(this->luawrapper);
 }
 
+class Luawrapper * Server::getLua(const std::string& vm, const std::string& init_script) {
+	if(vm.empty()) {
+		return(this->luawrapper);
+	}
+	auto it = this->vms.find(vm);
+	if(it != this->vms.end()) {
+		return(it->second);
+	}
+	info("Lua VM '"+vm+"' created.");
+	class Luawrapper * lua = new Luawrapper(this, vm, init_script);
+	this->vms[vm] = lua;
+	return(lua);
+}
+
 void Server::loop() {
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+
+	// Time spent in each phase of an iteration, waiting excluded.
+	Histogram& tick = Metrics::histogram("tick_seconds", "");
+	Histogram& connections = Metrics::histogram("phase_seconds", "phase=\"connections\"");
+	Histogram& consoles = Metrics::histogram("phase_seconds", "phase=\"console\"");
+	Histogram& timers = Metrics::histogram("phase_seconds", "phase=\"timers\"");
+	Histogram& actions = Metrics::histogram("phase_seconds", "phase=\"actions\"");
+	Histogram& journals = Metrics::histogram("phase_seconds", "phase=\"journal\"");
+	Histogram& flushes = Metrics::histogram("phase_seconds", "phase=\"players\"");
+
 	while(not this->stop) {
-		this->check_connection();
-		this->check_console();
-		this->check_players();
-		this->check_timers();
+		// Sleep until something happens.
+		this->armTimer();
+		int timeout = this->resumes.empty() ? -1 : 0;
+		if(this->journal and timeout != 0) {
+			timeout = this->journal->getSyncDelay(); // Or the last batch waits for the next event to be synced.
+		}
+		int n = epoll_wait(this->epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+		if(n == -1) {
+			if(errno != EINTR) {
+				warning("Event loop wait failed");
+			}
+			continue;
+		}
+		Timing timing(tick);
+
+		for(int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if(fd == this->connexion_fd) {
+				Timing timing(connections);
+				this->check_connection();
+			} else if(fd == console) {
+				Timing timing(consoles);
+				this->check_console();
+			} else if(fd == this->timer_fd) {
+				Timing timing(timers);
+				this->check_timers();
+			} else if(fd == this->metrics_fd) {
+				this->check_metrics();
+			} else if(this->scrapers.count(fd) > 0) {
+				this->check_scraper(fd);
+			} else {
+				// The player may have been deleted by a previous event's script.
+				// Writable sockets are flushed by check_players().
+				auto player = this->players.find(fd);
+				if(player != this->players.end() and (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+					Timing timing(actions);
+					player->second->check_action();
+				}
+			}
+		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if(not this->resumes.empty()) {
+			Timing timing(actions);
+			this->check_resumes();
+		}
+
+		// Write this loop's records before players see their effects.
+		if(this->journal) {
+			Timing timing(journals);
+			this->journal->commit();
+		}
+		{
+			Timing timing(flushes);
+			this->check_players();
+		}
+		if(this->snapshot_pid > 0) {
+			this->check_snapshot();
+		}
+	}
+}
+
+bool Server::openMetrics(unsigned short port) {
+	if(this->metrics_fd != -1) {
+		this->unwatch(this->metrics_fd);
+		close(this->metrics_fd);
+		this->metrics_fd = -1;
+	}
+
+	int sockfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(sockfd == -1) {
+		warning("Unable to create metrics socket");
+		return(false);
+	}
+	int yes = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+
+	// Local only: scrapers run on the host, or tunnel.
+	struct sockaddr_in addr {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+			or listen(sockfd, MAX_SOCKET_QUEUE) == -1) {
+		warning("Unable to listen for metrics on port "+std::to_string(port));
+		close(sockfd);
+		return(false);
 	}
+
+	this->metrics_fd = sockfd;
+	this->watch(sockfd);
+	info("Metrics on 127.0.0.1:"+std::to_string(port)+".");
+	return(true);
+}
+
+std::vector<struct Server::Stat> Server::getStats() {
+	std::vector<struct Stat> stats;
+
+	for(unsigned int counter = 0; counter < COUNTER_COUNT; counter++) {
+		stats.push_back({ std::string(Metrics::getName((Counter) counter))+"_total", "", (double) Metrics::get((Counter) counter), "counter" });
+	}
+
+	stats.push_back({ "players", "", (double) this->players.size(), "gauge" });
+	stats.push_back({ "characters", "", (double) this->characters.size(), "gauge" });
+	stats.push_back({ "timers", "", (double) this->timers.size(), "gauge" });
+
+	const char * type = "gauge";
+	for(auto& it : this->zones) {
+		stats.push_back({ "zone_characters", "{zone=\""+it.first+"\"}", (double) it.second->getPopulation(), type });
+		type = nullptr;
+	}
+
+	stats.push_back({ "lua_memory_bytes", "{vm=\"\"}", (double) this->luawrapper->getMemory(), "gauge" });
+	for(auto& it : this->vms) {
+		stats.push_back({ "lua_memory_bytes", "{vm=\""+it.first+"\"}", (double) it.second->getMemory(), nullptr });
+	}
+
+	// Histograms as summaries, in seconds.
+	static const double quantiles[] = { 50, 90, 99, 100 };
+	std::string last;
+	for(auto& it : Metrics::getHistograms()) {
+		const std::string& name = it.first.first;
+		const std::string& labels = it.first.second;
+		const class Histogram& histogram = it.second;
+		std::string prefix = labels.empty() ? "{" : "{"+labels+",";
+		for(double quantile : quantiles) {
+			char q[16];
+			snprintf(q, sizeof(q), "%g", quantile / 100);
+			std::uint64_t ns = quantile == 100 ? histogram.getMax() : histogram.getPercentile(quantile);
+			stats.push_back({ name, prefix+"quantile=\""+q+"\"}", ns / 1e9, name != last ? "summary" : nullptr });
+			last = name;
+		}
+		std::string suffix = labels.empty() ? "" : "{"+labels+"}";
+		stats.push_back({ name+"_sum", suffix, histogram.getSum() / 1e9, nullptr });
+		stats.push_back({ name+"_count", suffix, (double) histogram.getCount(), nullptr });
+	}
+
+	return(stats);
 }
 
 /* Private */
 
+void Server::watch(int fd) {
+	struct epoll_event event {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if(epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		warning("Unable to watch file descriptor #"+std::to_string(fd));
+	}
+}
+
+void Server::unwatch(int fd) {
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Server::watchOutput(int fd, bool output) {
+	struct epoll_event event {};
+	event.events = output ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+	event.data.fd = fd;
+	epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
 void Server::check_connection() {
 	struct sockaddr_in remote_addr;
 	socklen_t addr_len = sizeof(struct sockaddr_in);
@@ -312,6 +841,7 @@ void Server::check_connection() {
 
 	// Make non-blocking.
 	fcntl(fd, F_SETFL, O_NONBLOCK);
+	Metrics::count(COUNTER_CONNECTIONS);
 
 	info(
 		"Got connexion from "
@@ -334,7 +864,8 @@ void Server::check_connection() {
 	this->addCharacter(character);
 
 	class Player * player = new Player(fd, character);
-	this->players.push_back(player);
+	this->players[fd] = player;
+	this->watch(fd);
 	character->setPlayer(player);
 	character->changeZone(spawn_z, spawn_x, spawn_y);
 	this->luawrapper->spawnScript(character);
@@ -352,7 +883,9 @@ void Server::check_console() {
 	}
 
 	if(flag <= 0) {
+		// EOF or error: stop polling, or the loop would spin on a readable fd.
 		warning("Console read error.");
+		this->unwatch(console);
 		return;
 	}
 
@@ -361,38 +894,248 @@ void Server::check_console() {
 	this->getLua()->executeCode(input);
 }
 
+void Server::check_metrics() {
+	int fd = accept4(this->metrics_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd == -1) {
+		return;
+	}
+
+	// Never wait on a scraper: it is served by the loop as its socket is ready.
+	// Those stalled are dropped to make room.
+	std::uint64_t now = Metrics::now();
+	auto it = this->scrapers.begin();
+	while(it != this->scrapers.end()) {
+		int stalled = it->first;
+		bool expired = now - it->second.since > METRICS_TIMEOUT * 1000000ull;
+		it++;
+		if(expired) {
+			this->closeScraper(stalled);
+		}
+	}
+	if(this->scrapers.size() >= METRICS_SCRAPERS) {
+		close(fd);
+		return;
+	}
+	this->scrapers[fd] = Scraper{ now, "", 0 };
+	this->watch(fd);
+}
+
+void Server::check_scraper(int fd) {
+	struct Scraper& scraper = this->scrapers[fd];
+	if(scraper.response.empty()) {
+		// Any request gets the metrics.
+		char buffer[BUFSIZ];
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		if(length == -1 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+			return;
+		}
+		if(length <= 0) {
+			this->closeScraper(fd);
+			return;
+		}
+
+		std::string body;
+		for(const struct Stat& stat : this->getStats()) {
+			if(stat.type) {
+				body += "# TYPE hackraft_"+stat.name+" "+stat.type+"\n";
+			}
+			char value[32];
+			snprintf(value, sizeof(value), "%.9g", stat.value);
+			body += "hackraft_"+stat.name+stat.labels+" "+value+"\n";
+		}
+		scraper.response =
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: "+std::to_string(body.length())+"\r\n"
+			"\r\n"
+			+body;
+	}
+
+	while(scraper.written < scraper.response.length()) {
+		ssize_t written = write(fd, scraper.response.data() + scraper.written, scraper.response.length() - scraper.written);
+		if(written == -1 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+			this->watchOutput(fd, true); // The rest when it can be written.
+			return;
+		}
+		if(written <= 0) {
+			break;
+		}
+		scraper.written += written;
+	}
+	shutdown(fd, SHUT_RDWR);
+	this->closeScraper(fd);
+}
+
+void Server::closeScraper(int fd) {
+	this->unwatch(fd);
+	close(fd);
+	this->scrapers.erase(fd);
+}
+
 void Server::check_players() {
 	auto player = this->players.begin();
 	while(player != this->players.end()) {
-		if((*player)->delme()) {
-			delete(*player);
+		if(player->second->delme()) {
+			this->unwatch(player->first);
+			delete(player->second);
 			player = this->players.erase(player);
 		} else {
-			(*player)->check_action();
 			player++;
 		}
 	}
+
+	// Messages of this loop are sent together, including the deleted players' exits.
+	for(auto& it : this->players) {
+		bool stalled = it.second->isStalled();
+		if(it.second->flush() == stalled) {
+			this->watchOutput(it.first, not stalled);
+		}
+	}
 }
 
-void Server::check_timers() {
-	static auto prev = std::chrono::high_resolution_clock::now();
+void Server::check_resumes() {
+	std::vector<std::pair<class Luawrapper *, int>> resumes;
+	resumes.swap(this->resumes);
+	for(auto& it : resumes) {
+		it.first->resume(it.second);
+	}
+}
 
-	auto now = std::chrono::high_resolution_clock::now();
-	if(now >= prev + std::chrono::seconds(1)) {
+void Server::check_timers() {
+	uint64_t expirations; // Only cleared: the clock tells what is due.
+	if(read(this->timer_fd, &expirations, sizeof(expirations)) == -1 and errno != EAGAIN) {
+		warning("Unable to read timer");
+	}
+	// Catch up with the clock, jumping over the ticks where nothing happens.
+	unsigned long target = this->currentTick();
+	while(this->timer_now < target) {
+		unsigned long next = this->nextTimerTick();
+		if(next > target) {
+			this->timer_now = target;
+			break;
+		}
+		this->timer_now = next - 1;
 		this->step_timers();
-		prev = now;
 	}
 }
 
+unsigned long Server::currentTick() {
+	return((Metrics::now() - this->timer_origin) / (TIMER_TICK * 1000000ul));
+}
+
+unsigned long Server::nextTimerTick() {
+	if(this->timers.size() == 0) {
+		return(ULONG_MAX);
+	}
+	const unsigned long mask = (1ul << TIMER_WHEEL_BITS) - 1;
+	unsigned long next = ULONG_MAX;
+	// First non-empty slot of each level: fired at level 0, cascaded above.
+	for(unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		unsigned int shift = level * TIMER_WHEEL_BITS;
+		unsigned long base = this->timer_now >> shift;
+		for(unsigned long i = 1; i <= mask + 1; i++) {
+			if(not this->timer_wheel[(level << TIMER_WHEEL_BITS) + ((base + i) & mask)].empty()) {
+				next = std::min(next, (base + i) << shift);
+				break;
+			}
+		}
+	}
+	return(next);
+}
+
+void Server::armTimer() {
+	unsigned long next = this->nextTimerTick();
+	if(next == this->timer_armed) {
+		return;
+	}
+	this->timer_armed = next;
+	struct itimerspec when {}; // Zero: disarmed.
+	if(next != ULONG_MAX) {
+		std::uint64_t ns = this->timer_origin + next * TIMER_TICK * 1000000ul;
+		when.it_value = { (time_t) (ns / 1000000000ul), (long) (ns % 1000000000ul) };
+	}
+	timerfd_settime(this->timer_fd, TFD_TIMER_ABSTIME, &when, nullptr);
+}
+
 void Server::step_timers() {
-	for(auto it = this->timers.begin(); it != this->timers.end(); ) {
-		it->second.remaining--;
-		if(it->second.remaining == 0) {
-			Script script = std::move(it->second.script);
-			it = this->timers.erase(it);
-			script.execute(*luawrapper);
-		} else {
-			it++;
+	this->timer_now++;
+	const unsigned long mask = (1ul << TIMER_WHEEL_BITS) - 1;
+
+	// Cascade the higher level slots the clock just reached.
+	for(unsigned int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		unsigned int shift = level * TIMER_WHEEL_BITS;
+		if((this->timer_now & ((1ul << shift) - 1)) != 0) {
+			break;
+		}
+		std::list<Uuid> slot;
+		slot.swap(this->timer_wheel[(level << TIMER_WHEEL_BITS) + ((this->timer_now >> shift) & mask)]);
+		for(Uuid id : slot) {
+			struct Timer * timer = this->timers.find(id);
+			if(timer != nullptr) {
+				this->scheduleTimer(id, *timer);
+			}
 		}
 	}
+
+	// Trigger the expired ones. Scripts may delete others: pop one at a time.
+	std::list<Uuid>& slot = this->timer_wheel[this->timer_now & mask];
+	while(not slot.empty()) {
+		Uuid id = slot.front();
+		slot.pop_front();
+		struct Timer * timer = this->timers.find(id);
+		if(timer != nullptr) {
+			this->fireTimer(id, *timer);
+		}
+	}
+}
+
+void Server::scheduleTimer(Uuid id, struct Timer& timer) {
+	// Lowest level whose slots still span the remaining ticks.
+	unsigned long expiry = timer.expiry;
+	unsigned long delta = expiry > this->timer_now ? expiry - this->timer_now : 0;
+	const unsigned long mask = (1ul << TIMER_WHEEL_BITS) - 1;
+	unsigned int level = 0;
+	while(level < TIMER_WHEEL_LEVELS - 1 and delta >> ((level + 1) * TIMER_WHEEL_BITS) != 0) {
+		level++;
+	}
+	if(delta >> (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS) != 0) {
+		// Too far: wait in the last slot reachable, then be cascaded again.
+		expiry = this->timer_now + (1ul << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+	} else if(delta == 0) {
+		expiry = this->timer_now;
+	}
+	std::list<Uuid>& slot = this->timer_wheel[(level << TIMER_WHEEL_BITS) + ((expiry >> (level * TIMER_WHEEL_BITS)) & mask)];
+	timer.slot = &slot;
+	timer.it = slot.insert(slot.end(), id);
+}
+
+void Server::unscheduleTimer(struct Timer& timer) {
+	timer.slot->erase(timer.it);
+}
+
+void Server::fireTimer(Uuid id, struct Timer& timer) {
+	Script script = std::move(timer.script);
+	class Luawrapper * lua = timer.lua;
+	int thread = timer.thread;
+	this->timers.erase(id);
+	if(thread != LUA_NOREF) {
+		lua->resume(thread);
+	} else {
+		script.execute(*lua, nullptr, "", TRIGGER_TIMER);
+	}
+}
+
+void Server::check_snapshot() {
+	int status;
+	pid_t pid = waitpid(this->snapshot_pid, &status, WNOHANG);
+	if(pid == 0) {
+		return; // Still writing.
+	}
+	if(pid == this->snapshot_pid and WIFEXITED(status) and WEXITSTATUS(status) == 0) {
+		info("Snapshot written.");
+		if(this->journal and this->snapshot_journaled) this->journal->dropOld();
+	} else {
+		warning("Snapshot failed.");
+	}
+	this->snapshot_pid = 0;
 }
@@ -4,21 +4,38 @@ class Zone;
 class Luawrapper;
 class Character;
 class Inventory;
+class BinaryWriter;
 
 #include "script.h"
 #include "uuid.h"
 #include "artifact.h"
 #include "player.h"
+#include "registry.h"
 
 #include <map>
 #include <list>
+#include <vector>
 #include <string>
+#include <utility>
+#include <cstdint>
+
+#include <sys/types.h> // pid_t
 
 #define MAX_SOCKET_QUEUE 8
+#define MAX_EPOLL_EVENTS 64
+#define TIMER_TICK 1 // Timers resolution, in milliseconds.
+#define TIMER_WHEEL_BITS 6 // 64 slots per wheel level.
+#define TIMER_WHEEL_LEVELS 5 // 2^30 ticks, 12 days: longer timers are cascaded again.
+#define TIMER_WHEEL_SPAN ((1ul << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) * TIMER_TICK) // Milliseconds.
+#define METRICS_TIMEOUT 5000 // Milliseconds before a stalled scraper is dropped.
+#define METRICS_SCRAPERS 8 // Connections answered at once; more are refused.
+#define SNAPSHOT_FILE_MAGIC "HKSN"
+#define SNAPSHOT_FILE_VERSION 5
 
 class Server {
 public:
-	Server();
+	// Not interactive: no console nor init.lua, the caller drives the world (tests, benchmarks).
+	explicit Server(bool interactive = true);
 	~Server();
 
 	Server(Server const &) = delete;
@@ -46,50 +63,109 @@ public:
 	void doAction(std::string trigger, class Character& character, std::string arg = "");
 
 	Uuid newArtifact(Name name);
+	void addArtifact(Uuid id, class Artifact * artifact); // Replace any other.
 	void delArtifact(Uuid id);
 	class Artifact* getArtifact(Uuid id); // May return nullptr.
 
 	Uuid newInventory(unsigned int size);
+	void addInventory(Uuid id, class Inventory * inventory); // Replace any other.
 	void delInventory(Uuid id);
 	class Inventory* getInventory(Uuid id); // May return nullptr.
 
-	/* Timers */
-	Uuid addTimer(unsigned int duration, const Script& script);
+	/* Timers, durations in milliseconds */
+	Uuid addTimer(unsigned long duration, const Script& script, class Luawrapper * lua = nullptr); // Main VM by default.
 	void delTimer(Uuid id);
 	void triggerTimer(Uuid id);
-	unsigned int getTimerRemaining(Uuid id); // 0 is not-found.
-	void setTimerRemaining(Uuid id, unsigned int remaining);
-
-	class Luawrapper * getLua();
-
+	unsigned long getTimerRemaining(Uuid id); // 0 is not-found.
+	void setTimerRemaining(Uuid id, unsigned long remaining);
+	void addWait(unsigned long duration, class Luawrapper * lua, int thread); // Resume a coroutine.
+	void resumeLater(class Luawrapper * lua, int thread); // At the end of the loop iteration.
+
+	/* Snapshots: characters, gauges, artifacts, inventories, timers, their tags. */
+	// Written by a forked process, from a copy-on-write view of the world.
+	bool saveSnapshot(const std::string& filename); // False if not started.
+	bool loadSnapshot(const std::string& filename); // Zones must exist already.
+
+	/* Journal: mutations since the last snapshot, replayed when opened. */
+	bool openJournal(const std::string& filename, unsigned int sync_interval); // After loadSnapshot().
+	class Journal * getJournal(); // May return nullptr.
+
+	/* Metrics: Prometheus text format on a local port, and Lua stats(). */
+	bool openMetrics(unsigned short port); // Listen on 127.0.0.1.
+	struct Stat { std::string name; std::string labels; double value; const char * type; }; // No type: part of the previous.
+	std::vector<struct Stat> getStats();
+
+	class Luawrapper * getLua(); // The main VM.
+	// Isolated VM, created on first use by running init_script. "" is the main one.
+	class Luawrapper * getLua(const std::string& vm, const std::string& init_script = "");
+
+	// TODO: Zones owned by worker threads, with queues between them for changeZone() and zone events.
 	void loop();
 
 private:
-	int connexion_fd;
+	int connexion_fd; // -1 when closed: 0 is the console.
+	int metrics_fd = -1;
+	// Metrics connections, by file descriptor: served as they become ready.
+	struct Scraper { std::uint64_t since; std::string response; std::size_t written; }; // No response before the request.
+	std::map<int, struct Scraper> scrapers;
 	unsigned short port;
 	bool stop = false;
-	std::map<std::string, class Zone *> zones;
-	std::map<Uuid, class Character *> characters;
+	Registry<std::string, class Zone *> zones;
+	Registry<Uuid, class Character *> characters;
 	std::map<std::string, Script> actions;
-	std::map<Uuid, class Artifact *> artifacts;
-	std::map<Uuid, class Inventory *> inventories;
-	std::list<class Player *> players;
+	Registry<Uuid, class Artifact *> artifacts;
+	Registry<Uuid, class Inventory *> inventories;
+	std::map<int, class Player *> players; // By file descriptor.
+
+	/* Event loop */
+	int epoll_fd;
+	int timer_fd;
 
-	/* Timers */
-	struct Timer { unsigned int remaining; Script script; };
-	std::map<Uuid,struct Timer> timers;
+	/* Timers: hierarchical timing wheel. Level n slots span 64^n ticks,
+	 * they are cascaded to lower levels when the clock reaches them. */
+	// thread is a waiting coroutine to resume instead of script, or LUA_NOREF.
+	struct Timer { unsigned long expiry; Script script; class Luawrapper * lua; int thread; std::list<Uuid> * slot; std::list<Uuid>::iterator it; };
+	Registry<Uuid, struct Timer> timers;
+	std::vector<std::list<Uuid>> timer_wheel;
+	unsigned long timer_now = 0; // Ticks stepped: lags the clock while nothing is due.
+	std::uint64_t timer_origin; // Tick 0, in monotonic nanoseconds.
+	unsigned long timer_armed = 0; // Tick the timerfd fires at, ULONG_MAX when disarmed.
+
+	std::vector<std::pair<class Luawrapper *, int>> resumes; // Coroutines, by resumeLater().
+
+	pid_t snapshot_pid = 0; // Process writing a snapshot.
+	bool snapshot_journaled = false; // The journal was rotated for it.
+
+	class Journal * journal = nullptr;
+	std::uint64_t journal_sequence = 0; // Of the loaded snapshot.
 
 	class Luawrapper * luawrapper;
+	std::map<std::string, class Luawrapper *> vms; // Isolated VMs, by name.
 
 	/* Spawn */
 	std::string spawn_zone;
 	unsigned int spawn_x;
 	unsigned int spawn_y;
 
+	void watch(int fd); // Add the file descriptor to the event loop.
+	void unwatch(int fd);
+	void watchOutput(int fd, bool output); // Also wait for fd to be writable?
+
 	void check_connection();
-	void check_action(class Player* player);
 	void check_console();
-	void check_players();
+	void check_metrics(); // Accept a scraper.
+	void check_scraper(int fd); // Read its request, write the answer.
+	void closeScraper(int fd);
+	void check_players(); // Delete disconnected players, flush the others.
 	void check_timers();
-	void step_timers();
+	void check_resumes(); // Those resumed now may queue others: for the next iteration.
+	unsigned long currentTick(); // Of the clock.
+	unsigned long nextTimerTick(); // Where a slot is fired or cascaded, ULONG_MAX without timers.
+	void armTimer(); // One-shot for nextTimerTick(), before sleeping.
+	void step_timers(); // Advance the clock by one tick.
+	void scheduleTimer(Uuid id, struct Timer& timer); // Put it in the wheel.
+	void unscheduleTimer(struct Timer& timer);
+	void fireTimer(Uuid id, struct Timer& timer); // Erase it, then run it.
+	void writeSnapshot(class BinaryWriter& file);
+	void check_snapshot(); // Reap the process writing it.
 };
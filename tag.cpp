@@ -12,6 +12,10 @@ bool TagID::operator < (const TagID& rhs) const {
 	return(this->data < rhs.data);
 }
 
+const std::string& TagID::toString() const {
+	return(this->data);
+}
+
 /* Tag Value */
 
 TagValue::TagValue(std::string value) : data(value) { }
@@ -34,9 +38,19 @@ const TagValue& Tagged::getTag(const TagID& id) {
 
 void Tagged::setTag(const TagID& id, const TagValue& value) {
 	this->tags[id] = value;
+	this->tagChanged(id, &value);
 }
 
 void Tagged::delTag(const TagID& id) {
-	this->tags.erase(id);
+	if(this->tags.erase(id) > 0) {
+		this->tagChanged(id, nullptr);
+	}
 }
 
+bool Tagged::hasTags() const {
+	return(not this->tags.empty());
+}
+
+const std::map<TagID, TagValue>& Tagged::getTags() const {
+	return(this->tags);
+}
@@ -9,6 +9,7 @@ public:
 	bool operator == (const TagID& rhs) const;
 	bool operator != (const TagID& rhs) const { return(not (*this == rhs) ); }
 	bool operator < (const TagID& rhs) const;
+	const std::string& toString() const;
 
 private:
 	std::string data;
@@ -28,9 +29,22 @@ private:
 
 class Tagged {
 public:
+	Tagged() = default;
+	Tagged(const Tagged&) = default;
+	Tagged(Tagged&&) = default;
+	Tagged& operator = (const Tagged&) = default;
+	Tagged& operator = (Tagged&&) = default;
+	virtual ~Tagged() = default;
+
 	const TagValue& getTag(const TagID& id);
 	void setTag(const TagID& id, const TagValue& value);
 	void delTag(const TagID& id);
+	bool hasTags() const;
+	const std::map<TagID, TagValue>& getTags() const;
+
+protected:
+	// Every change goes through here, for owners to journal it. nullptr: deleted.
+	virtual void tagChanged(const TagID& id, const TagValue * value) { }
 
 private:
 	std::map<TagID, TagValue> tags;
@@ -1,40 +1,54 @@
 #include "uuid.h"
 
-#include <ctime>
+std::uint64_t Uuid::last = 0;
 
 Uuid::Uuid() :
-	timestamp { time(nullptr) },
-	random { rand() }
+	value { ++Uuid::last }
 { }
 
-Uuid::Uuid(const std::string& s) {
-	size_t middle = s.find_first_of(".");
-	if(middle == std::string::npos) {
-		this->timestamp = 0;
-		this->random = 0;
-	}
+Uuid::Uuid(const std::string& s) : Uuid(s.c_str()) { }
 
-	try  {
-		this->timestamp = std::stoi(s.substr(0, middle));
-		this->random = std::stoi(s.substr(middle+1));
-	} catch(...) { // Invalid argument or Out of range.
-		this->timestamp = 0;
-		this->random = 0;
+Uuid::Uuid(const char * s) :
+	value { 0 }
+{
+	if(s == nullptr or *s == '\0') {
+		return;
+	}
+	std::uint64_t value = 0;
+	for(; *s != '\0'; s++) {
+		if(*s < '0' or *s > '9' or value > (UINT64_MAX - (*s - '0')) / 10) {
+			return; // Invalid or out of range.
+		}
+		value = value * 10 + (*s - '0');
 	}
+	this->value = value;
 }
 
 bool Uuid::operator == (const Uuid& rhs) const {
-	return(timestamp == rhs.timestamp and random == rhs.random);
+	return(value == rhs.value);
 }
 
 bool Uuid::operator < (const Uuid& rhs) const {
-	if(timestamp == rhs.timestamp) {
-		return(random < rhs.random);
-	} else {
-		return(timestamp < rhs.timestamp);
-	}
+	return(value < rhs.value);
 }
 
 std::string Uuid::toString() const {
-	return(std::to_string(timestamp) + "." + std::to_string(random));
+	return(std::to_string(value));
+}
+
+bool Uuid::isNull() const {
+	return(value == 0);
+}
+
+std::uint64_t Uuid::toInteger() const {
+	return(value);
+}
+
+Uuid Uuid::fromInteger(std::uint64_t value) {
+	Uuid id { "" };
+	id.value = value;
+	if(value > Uuid::last) {
+		Uuid::last = value;
+	}
+	return(id);
 }
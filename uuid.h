@@ -1,17 +1,43 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 
+// Ids are generated in increasing order and never reused while the server runs.
+// 0 is the null id, never generated: it is what invalid strings parse to.
 class Uuid {
 public:
-	Uuid();
+	Uuid(); // Generate a new id.
 	Uuid(const std::string& s);
+	Uuid(const char * s); // Non-throwing decimal parser.
 	bool operator == (const Uuid& rhs) const;
 	bool operator != (const Uuid& rhs) const { return(not (*this == rhs) ); }
 	bool operator < (const Uuid& rhs) const;
 	std::string toString() const;
 
+	bool isNull() const;
+	std::uint64_t toInteger() const;
+
+	// Id saved earlier: it won't be generated again.
+	static Uuid fromInteger(std::uint64_t value);
+
 private:
-	long int timestamp;
-	int random;
+	std::uint64_t value;
+
+	static std::uint64_t last; // Last generated id.
 };
+
+namespace std {
+	template<> struct hash<Uuid> {
+		std::size_t operator () (const Uuid& id) const {
+			// Mix the bits: consecutive ids must not fill consecutive buckets.
+			std::uint64_t x = id.toInteger();
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccdull;
+			x ^= x >> 33;
+			return(x);
+		}
+	};
+}
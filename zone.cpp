@@ -5,6 +5,12 @@
 #include "character.h"
 #include "server.h"
 #include "log.h"
+#include "binary.h"
+
+#include <algorithm> // std::find(), std::min(), std::max()
+#include <cstdlib> // abs()
+#include <cstring> // memcpy()
+#include <unordered_map>
 
 // TODO : Zone::setName() : broadcast new name.
 
@@ -22,18 +28,210 @@ Zone::Zone(
 	width(width),
 	height(height)
 {
-	this->places = std::vector<class Place>(width * height, Place(base_aspect));
+	this->aspects.assign(width * height, base_aspect);
+	this->walkable.assign(width * height, true);
+	this->chunks_width = (width + ZONE_CHUNK_SIZE - 1) / ZONE_CHUNK_SIZE;
+	this->chunks_height = (height + ZONE_CHUNK_SIZE - 1) / ZONE_CHUNK_SIZE;
+	this->chunks.resize(this->chunks_width * this->chunks_height, Chunk{});
+	this->cells_width = (width + ZONE_CELL_SIZE - 1) / ZONE_CELL_SIZE;
+	unsigned int cells_height = (height + ZONE_CELL_SIZE - 1) / ZONE_CELL_SIZE;
+	this->cells.resize(std::max(this->cells_width * cells_height, 1u));
+	class Zone * old = this->server->getZone(id);
+	if(old) {
+		this->lua = old->lua; // A replaced zone keeps its VM.
+	}
 	this->server->addZone(id, this); // XXX ??
 }
 
 Zone::~Zone() {
 	// For now, characters in a zone are deleted with it.
-	for(Uuid id : this->characters) {
+	// Copy: each deletion removes the character from the list.
+	std::list<Uuid> characters = this->characters;
+	for(Uuid id : characters) {
 		this->server->delCharacter(id);
 	}
 	info("Zone '"+id+"' deleted.");
 }
 
+/* Zone file, native byte order:
+ * magic "HKZN", version 32, name, width 32, height 32, view radius 32,
+ * palette: count 32, aspect names,
+ * aspects: width*height palette indexes 16, chunk by chunk as Zone::index() lays them,
+ * walkability: width*height bits, in the same order,
+ * landon scripts: count 32, then x 32, y 32, script,
+ * tags: count of places 32, then x 32, y 32, count 32, (id, value)...
+ * Strings are a 32 bits length then bytes. */
+
+void Zone::readTags(class BinaryReader& file, std::vector<struct PlaceTag>& tags) {
+	std::uint32_t count = file.get32();
+	for(std::uint32_t n = 0; n < count and file.isValid(); n++) {
+		std::uint32_t x = file.get32();
+		std::uint32_t y = file.get32();
+		std::uint32_t place_tags = file.get32();
+		for(std::uint32_t t = 0; t < place_tags and file.isValid(); t++) {
+			TagID tag_id { file.getString() };
+			TagValue value { file.getString() };
+			if(file.isValid()) {
+				tags.push_back({ x, y, tag_id, value });
+			}
+		}
+	}
+}
+
+bool Zone::save(const std::string& filename) {
+	BinaryWriter file;
+	file.putBytes(ZONE_FILE_MAGIC, 4);
+	file.put32(ZONE_FILE_VERSION);
+	file.putString(this->getName().toString());
+	file.put32(this->width);
+	file.put32(this->height);
+	file.put32(this->view_radius);
+
+	// Palette of the aspects used, by aspect id.
+	std::unordered_map<std::uint32_t, std::uint16_t> palette;
+	std::vector<std::uint16_t> cells;
+	cells.reserve(this->aspects.size());
+	std::vector<std::uint8_t> walkable((this->aspects.size() + 7) / 8, 0);
+	std::vector<Aspect> palette_aspects;
+	// In the zone's own order: loading copies them back as they are.
+	for(std::size_t i = 0; i < this->aspects.size(); i++) {
+		const Aspect& aspect = this->aspects[i];
+		auto it = palette.find(aspect.toId());
+		if(it == palette.end()) {
+			if(palette.size() > UINT16_MAX) {
+				warning("Zone '"+this->id+"' has too many aspects to be saved.");
+				return(false);
+			}
+			it = palette.emplace(aspect.toId(), palette.size()).first;
+			palette_aspects.push_back(aspect);
+		}
+		cells.push_back(it->second);
+		if(this->walkable[i]) {
+			walkable[i / 8] |= 1 << (i % 8);
+		}
+	}
+	file.put32(palette_aspects.size());
+	for(const Aspect& aspect : palette_aspects) {
+		file.putString(aspect.toString());
+	}
+	file.putBytes(cells.data(), cells.size() * sizeof(std::uint16_t));
+	file.putBytes(walkable.data(), walkable.size());
+
+	int x, y;
+	file.put32(this->whenWalkOn.size());
+	for(auto& it : this->whenWalkOn) {
+		this->position(it.first, x, y);
+		file.put32(x);
+		file.put32(y);
+		file.putString(it.second.toString());
+	}
+	this->saveTags(file);
+
+	return(file.save(filename));
+}
+
+class Zone * Zone::load(class Server * server, std::string id, const std::string& filename) {
+	BinaryReader file { filename };
+	if(not file.isOpen()) {
+		warning("Unable to open zone file '"+filename+"'.");
+		return(nullptr);
+	}
+	const char * magic = file.getBytes(4);
+	if(magic == nullptr or memcmp(magic, ZONE_FILE_MAGIC, 4) != 0 or file.get32() != ZONE_FILE_VERSION) {
+		warning("'"+filename+"' isn't a zone file of version "+std::to_string(ZONE_FILE_VERSION)+".");
+		return(nullptr);
+	}
+
+	// Check the whole file before replacing any zone.
+	Name name { file.getString() };
+	std::uint32_t width = file.get32();
+	std::uint32_t height = file.get32();
+	std::uint32_t view_radius = file.get32();
+	std::uint32_t palette_size = file.get32();
+	std::vector<Aspect> palette;
+	for(std::uint32_t i = 0; i < palette_size and file.isValid(); i++) {
+		palette.push_back(Aspect { file.getString() });
+	}
+	std::size_t places = (std::size_t) width * height;
+	const char * cells = file.getBytes(places * sizeof(std::uint16_t));
+	const char * walkable = file.getBytes((places + 7) / 8);
+	if(not file.isValid()) {
+		warning("Zone file '"+filename+"' is truncated.");
+		return(nullptr);
+	}
+
+	std::vector<struct PlaceScript> scripts;
+	std::uint32_t count = file.get32();
+	for(std::uint32_t n = 0; n < count and file.isValid(); n++) {
+		std::uint32_t x = file.get32();
+		std::uint32_t y = file.get32();
+		scripts.push_back({ x, y, Script { file.getString() } });
+	}
+	std::vector<struct PlaceTag> tags;
+	readTags(file, tags);
+	if(not file.isValid()) {
+		warning("Zone file '"+filename+"' is truncated.");
+		return(nullptr);
+	}
+
+	// All read: replace the zone.
+	class Zone * zone = new Zone(server, id, name, width, height, Aspect{});
+	zone->view_radius = view_radius;
+	// Same sizes, same layout: straight copies, the palette aside.
+	std::vector<std::uint16_t> indexes(places);
+	memcpy(indexes.data(), cells, places * sizeof(std::uint16_t));
+	for(std::size_t i = 0; i < places; i++) {
+		zone->aspects[i] = indexes[i] < palette.size() ? palette[indexes[i]] : Aspect{};
+	}
+	for(std::size_t i = 0; i < places; i++) {
+		zone->walkable[i] = (walkable[i / 8] >> (i % 8)) & 1;
+	}
+	for(const struct PlaceScript& script : scripts) {
+		if(zone->isPlaceValid(script.x, script.y)) {
+			zone->whenWalkOn.insert(zone->index(script.x, script.y), script.script);
+		}
+	}
+	zone->setTags(tags);
+	return(zone);
+}
+
+void Zone::setTags(const std::vector<struct PlaceTag>& tags) {
+	// Not through Place::setTag(): what files hold isn't journaled.
+	for(const struct PlaceTag& tag : tags) {
+		if(this->isPlaceValid(tag.x, tag.y)) {
+			std::size_t index = this->index(tag.x, tag.y);
+			Tagged * tagged = this->tags.find(index);
+			if(tagged == nullptr) {
+				tagged = &this->tags.insert(index, Tagged{});
+			}
+			tagged->setTag(tag.id, tag.value);
+		}
+	}
+}
+
+void Zone::saveTags(class BinaryWriter& file) {
+	int x, y;
+	file.put32(this->tags.size());
+	for(auto& it : this->tags) {
+		this->position(it.first, x, y);
+		file.put32(x);
+		file.put32(y);
+		file.put32(it.second.getTags().size());
+		for(auto& tag : it.second.getTags()) {
+			file.putString(tag.first.toString());
+			file.putString(tag.second.toString());
+		}
+	}
+}
+
+bool Zone::loadTags(class BinaryReader& file) {
+	std::vector<struct PlaceTag> tags;
+	readTags(file, tags);
+	this->tags = Registry<std::size_t, Tagged>{};
+	this->setTags(tags);
+	return(file.isValid());
+}
+
 class Server * Zone::getServer() {
 	return(this->server);
 }
@@ -61,42 +259,164 @@ void Zone::event(std::string message) {
 	}
 }
 
+unsigned int Zone::getViewRadius() {
+	return(this->view_radius);
+}
+
+void Zone::setViewRadius(unsigned int radius) {
+	this->view_radius = radius;
+}
+
+std::size_t Zone::getPopulation() {
+	return(this->characters.size());
+}
+
+class Luawrapper * Zone::getLua() {
+	return(this->lua ? this->lua : this->server->getLua());
+}
+
+void Zone::setLua(class Luawrapper * lua) {
+	this->lua = lua;
+}
+
 /* Called by Character only */
 
 bool Zone::canLandCharacter(class Character * character, int x, int y) {
-	class Place * place;
-	if(this->isPlaceValid(x,y) && (place = this->getPlace(x,y)) != nullptr) {
-		return(place->isWalkable());
-	} else {
-		return(false);
-	}
+	return(this->isPlaceValid(x,y) and this->walkable[this->index(x, y)]);
 }
 
 void Zone::enterCharacter(class Character * character, int x, int y) {
 	this->characters.push_front(character->getId());
-	character->setXY(x, y);
 	character->updateFloor();
-	this->updateCharacter(character);
-	for(Uuid id : this->characters) {
-		if(id != character->getId()) {
-			class Character * p = this->getCharacter(id);
-			if(p) character->updateCharacter(p);
-		}
-	}
+	// Not in a cell yet: moveCharacter() makes everyone in view enter.
+	character->setXY(x, y);
 }
 
 void Zone::exitCharacter(class Character * character) {
 	this->characters.remove(character->getId());
-	for(Uuid id : this->characters) {
-		class Character * p = this->getCharacter(id);
-		if(p) p->updateCharacterExit(character);
+	character->clearFloor();
+	std::vector<class Character *>& cell = this->getCell(character->getX(), character->getY());
+	auto it = std::find(cell.begin(), cell.end(), character);
+	if(it != cell.end()) {
+		cell.erase(it);
+	}
+	for(class Character * p : this->getViewers(character->getX(), character->getY())) {
+		p->updateCharacterExit(character);
+	}
+}
+
+void Zone::moveCharacter(class Character * character, int old_x, int old_y) {
+	int x = character->getX();
+	int y = character->getY();
+
+	// Move to the new cell.
+	std::vector<class Character *>& old_cell = this->getCell(old_x, old_y);
+	auto it = std::find(old_cell.begin(), old_cell.end(), character);
+	bool entering = (it == old_cell.end()); // Wasn't in the zone.
+	if(not entering) {
+		old_cell.erase(it);
+	}
+	this->getCell(x, y).push_back(character);
+
+	// Left the view of some characters.
+	if(not entering) {
+		for(class Character * p : this->getViewers(old_x, old_y)) {
+			if(not this->sees(p, x, y)) {
+				p->updateCharacterExit(character);
+				character->updateCharacterExit(p);
+			}
+		}
+	}
+
+	// Moved in the view of others, or entered it.
+	character->updateCharacter(character);
+	for(class Character * p : this->getViewers(x, y)) {
+		if(p == character) {
+			continue;
+		}
+		p->updateCharacter(character);
+		if(entering or not this->sees(p, old_x, old_y)) {
+			character->updateCharacter(p);
+		}
 	}
 }
 
 void Zone::updateCharacter(class Character * character) {
-	for(Uuid id : this->characters) {
-		class Character * p = this->getCharacter(id);
-		if(p) p->updateCharacter(character);
+	for(class Character * p : this->getViewers(character->getX(), character->getY())) {
+		p->updateCharacter(character);
+	}
+}
+
+const std::string& Zone::getFloor(unsigned int protocol) {
+	if(protocol < 1 or protocol > 2) {
+		protocol = 1;
+	}
+	Floor& floor = this->floors[protocol-1];
+	if(floor.valid
+			and floor.revision == this->revision
+			and floor.aspects == Aspect::getRegistryRevision()) {
+		return(floor.data);
+	}
+
+	floor.data.clear();
+	floor.data.reserve(this->aspects.size() * 2);
+	this->encode(floor.data, 0, 0, this->width, this->height, protocol == 2);
+
+	floor.valid = true;
+	floor.revision = this->revision;
+	floor.aspects = Aspect::getRegistryRevision();
+	return(floor.data);
+}
+
+unsigned int Zone::getChunksWidth() {
+	return(this->chunks_width);
+}
+
+unsigned int Zone::getChunksHeight() {
+	return(this->chunks_height);
+}
+
+unsigned int Zone::getChunkId(int x, int y) {
+	return((y / ZONE_CHUNK_SIZE) * this->chunks_width + x / ZONE_CHUNK_SIZE);
+}
+
+const std::string& Zone::getChunk(unsigned int cx, unsigned int cy) {
+	Floor& floor = this->chunks[cy * this->chunks_width + cx].floor;
+	if(floor.valid and floor.aspects == Aspect::getRegistryRevision()) {
+		return(floor.data);
+	}
+
+	int x = cx * ZONE_CHUNK_SIZE;
+	int y = cy * ZONE_CHUNK_SIZE;
+	int w = std::min(this->width - x, (unsigned int) ZONE_CHUNK_SIZE);
+	int h = std::min(this->height - y, (unsigned int) ZONE_CHUNK_SIZE);
+	floor.data = "chunk "
+		+ std::to_string(cx)
+		+ " "
+		+ std::to_string(cy)
+		+ " "
+		+ std::to_string(w)
+		+ " "
+		+ std::to_string(h)
+		+ " ";
+	this->encode(floor.data, x, y, w, h, true);
+
+	floor.valid = true;
+	floor.aspects = Aspect::getRegistryRevision();
+	return(floor.data);
+}
+
+void Zone::holdChunk(unsigned int chunk_id) {
+	this->chunks[chunk_id].holders++;
+}
+
+void Zone::releaseChunk(unsigned int chunk_id) {
+	Chunk& chunk = this->chunks[chunk_id];
+	if(chunk.holders > 0 and --chunk.holders == 0) {
+		chunk.floor.valid = false;
+		std::string{}.swap(chunk.floor.data); // Free memory.
+		// TODO: Evict the places too, to runs of aspects, expanded when touched.
+		// They stay in the zone's dense arrays for now, 4 bytes and a bit each.
 	}
 }
 
@@ -112,9 +432,51 @@ class Character * Zone::getCharacter(Uuid id) {
 	}
 }
 
-class Place * Zone::getPlace(int x, int y) {
+std::vector<class Character *>& Zone::getCell(int x, int y) {
+	// Out of zone positions are clamped to the border cells.
+	int cx = std::min(std::max(x, 0), (int) this->width - 1) / ZONE_CELL_SIZE;
+	int cy = std::min(std::max(y, 0), (int) this->height - 1) / ZONE_CELL_SIZE;
+	return(this->cells[std::max(cy * (int) this->cells_width + cx, 0)]);
+}
+
+bool Zone::sees(class Character * character, int x, int y) {
+	if(this->view_radius == 0) {
+		return(true);
+	}
+	int radius = this->view_radius;
+	return(abs((int) character->getX() - x) <= radius and abs((int) character->getY() - y) <= radius);
+}
+
+std::vector<class Character *> Zone::getViewers(int x, int y) {
+	std::vector<class Character *> viewers;
+	if(this->view_radius == 0) {
+		for(auto& cell : this->cells) {
+			viewers.insert(viewers.end(), cell.begin(), cell.end());
+		}
+		return(viewers);
+	}
+
+	// Only the cells overlapping the view square.
+	int radius = this->view_radius;
+	int cx_min = std::max(x - radius, 0) / ZONE_CELL_SIZE;
+	int cy_min = std::max(y - radius, 0) / ZONE_CELL_SIZE;
+	int cx_max = std::min(std::max(x + radius, 0), (int) this->width - 1) / ZONE_CELL_SIZE;
+	int cy_max = std::min(std::max(y + radius, 0), (int) this->height - 1) / ZONE_CELL_SIZE;
+	for(int cy = cy_min; cy <= cy_max; cy++) {
+		for(int cx = cx_min; cx <= cx_max; cx++) {
+			for(class Character * character : this->cells[cy * this->cells_width + cx]) {
+				if(this->sees(character, x, y)) {
+					viewers.push_back(character);
+				}
+			}
+		}
+	}
+	return(viewers);
+}
+
+class Place Zone::getPlace(int x, int y) {
 	if(this->isPlaceValid(x,y)) {
-		return(&(this->places[y*this->width+x]));
+		return(Place(this, this->index(x, y)));
 	} else {
 		warning(
 			"In zone "
@@ -125,14 +487,15 @@ class Place * Zone::getPlace(int x, int y) {
 			+ std::to_string(y)
 			+ "."
 		);
-		return(nullptr);
+		return(Place(nullptr, 0));
 	}
 }
 
 void Zone::updatePlaceAspect(int x, int y) {
-	class Place * place = this->getPlace(x,y);
-	if(place) {
-		auto aspect = place->getAspect();
+	if(this->isPlaceValid(x,y)) {
+		this->revision++;
+		this->chunks[this->getChunkId(x, y)].floor.valid = false;
+		Aspect aspect = this->aspects[this->index(x, y)];
 		for(Uuid id : this->characters) {
 			class Character * character = this->getCharacter(id);
 			if(character) character->updateFloor(x, y, aspect);
@@ -140,3 +503,77 @@ void Zone::updatePlaceAspect(int x, int y) {
 	}
 }
 
+void Zone::updatePlaceAspects(int x, int y, unsigned int w, unsigned int h) {
+	if(w == 0 or h == 0) {
+		return;
+	}
+	if(w == 1 and h == 1) {
+		this->updatePlaceAspect(x, y);
+		return;
+	}
+	this->revision++;
+	for(unsigned int cy = y / ZONE_CHUNK_SIZE; cy <= (y + h - 1) / ZONE_CHUNK_SIZE; cy++) {
+		for(unsigned int cx = x / ZONE_CHUNK_SIZE; cx <= (x + w - 1) / ZONE_CHUNK_SIZE; cx++) {
+			this->chunks[cy * this->chunks_width + cx].floor.valid = false;
+		}
+	}
+	for(Uuid id : this->characters) {
+		class Character * character = this->getCharacter(id);
+		if(character) character->updateFloorRegion(x, y, w, h);
+	}
+}
+
+std::size_t Zone::index(int x, int y) {
+	// Chunks are stored one after the other, row by row. All chunks of a
+	// row have the same height, only the last column is narrower.
+	int cx = x / ZONE_CHUNK_SIZE;
+	int cy = y / ZONE_CHUNK_SIZE;
+	int chunk_height = std::min(this->height - cy * ZONE_CHUNK_SIZE, (unsigned int) ZONE_CHUNK_SIZE);
+	int chunk_width = std::min(this->width - cx * ZONE_CHUNK_SIZE, (unsigned int) ZONE_CHUNK_SIZE);
+	std::size_t offset = (std::size_t) cy * ZONE_CHUNK_SIZE * this->width
+		+ (std::size_t) chunk_height * cx * ZONE_CHUNK_SIZE;
+	return(offset + (y % ZONE_CHUNK_SIZE) * chunk_width + x % ZONE_CHUNK_SIZE);
+}
+
+void Zone::position(std::size_t index, int& x, int& y) {
+	// Rows of chunks, then chunks of the row, then places of the chunk.
+	std::size_t row = (std::size_t) ZONE_CHUNK_SIZE * this->width;
+	int cy = index / row;
+	index -= cy * row;
+	int chunk_height = std::min(this->height - cy * ZONE_CHUNK_SIZE, (unsigned int) ZONE_CHUNK_SIZE);
+	int cx = index / (chunk_height * ZONE_CHUNK_SIZE);
+	index -= (std::size_t) cx * chunk_height * ZONE_CHUNK_SIZE;
+	int chunk_width = std::min(this->width - cx * ZONE_CHUNK_SIZE, (unsigned int) ZONE_CHUNK_SIZE);
+	x = cx * ZONE_CHUNK_SIZE + index % chunk_width;
+	y = cy * ZONE_CHUNK_SIZE + index / chunk_width;
+}
+
+void Zone::encode(std::string& out, int x, int y, int w, int h, bool rle) {
+	// Row by row; with rle, runs of the same entry are written "entry*count".
+	int last = 0;
+	std::size_t run = 0;
+	for(int j = y; j < y + h; j++) {
+		for(int i = x; i < x + w; i++) {
+			int entry = this->aspects[this->index(i, j)].toEntry();
+			if(run > 0 and rle and entry == last) {
+				run++;
+				continue;
+			}
+			if(run > 0) {
+				out += std::to_string(last);
+				if(run > 1) {
+					out += "*" + std::to_string(run);
+				}
+				out += ",";
+			}
+			last = entry;
+			run = 1;
+		}
+	}
+	if(run > 0) {
+		out += std::to_string(last);
+		if(run > 1) {
+			out += "*" + std::to_string(run);
+		}
+	}
+}
@@ -3,15 +3,28 @@
 class Server;
 class Place;
 class Character;
+class Luawrapper;
+class BinaryWriter;
+class BinaryReader;
 
 #include "aspect.h"
 #include "name.h"
 #include "uuid.h"
+#include "script.h"
+#include "tag.h"
+#include "registry.h"
 
 #include <string>
+#include <cstdint>
 #include <vector>
 #include <list>
 
+#define ZONE_CELL_SIZE 16 // Side of the cells characters are indexed by.
+#define ZONE_CHUNK_SIZE 32 // Side of the chunks places are stored and streamed by.
+#define ZONE_CHUNK_VIEW 1 // Chunks streamed around a character, in each direction.
+#define ZONE_FILE_MAGIC "HKZN"
+#define ZONE_FILE_VERSION 2
+
 class Zone : public Named {
 public:
 	Zone(
@@ -24,16 +37,49 @@ public:
 	);
 	~Zone();
 
+	/* Binary zone files, see save(). */
+	bool save(const std::string& filename);
+	// Create the zone from a file, replacing any with this id. nullptr on error, the old one kept.
+	static class Zone * load(class Server * server, std::string id, const std::string& filename);
+	// Tags of the places, as in zone files. Loading replaces them all.
+	void saveTags(class BinaryWriter& file);
+	bool loadTags(class BinaryReader& file); // False if truncated.
+
 	class Server * getServer();
 	std::string getId();
 
 	unsigned int getWidth();
 	unsigned int getHeight();
 	bool isPlaceValid(int x, int y);
-	class Place * getPlace(int x, int y);
+	class Place getPlace(int x, int y); // Check Place::isValid().
 	void updatePlaceAspect(int x, int y);
+	// Places of the region changed: one floor update per character.
+	void updatePlaceAspects(int x, int y, unsigned int w, unsigned int h);
+
+	// Encoded aspect entries of every place, built once per revision.
+	// Protocol 1: "e,e,e,...". Protocol 2: runs "e*n,e,..." (n > 1).
+	const std::string& getFloor(unsigned int protocol);
+
+	/* Chunks, streamed to protocol 3 clients. */
+	unsigned int getChunksWidth();
+	unsigned int getChunksHeight();
+	unsigned int getChunkId(int x, int y); // x-y must be valid.
+	// "chunk <cx> <cy> <w> <h> <runs>", runs encoded as in protocol 2.
+	const std::string& getChunk(unsigned int cx, unsigned int cy);
+	// Count players holding a chunk; the encoding of unheld chunks is dropped.
+	void holdChunk(unsigned int chunk_id);
+	void releaseChunk(unsigned int chunk_id);
 
 	void event(std::string message); // Broadcast a message to all characters.
+	std::size_t getPopulation(); // Characters in the zone.
+
+	// Characters only see others within this distance. 0 is the whole zone.
+	unsigned int getViewRadius();
+	void setViewRadius(unsigned int radius); // Applies on next moves.
+
+	// Scripts triggered in the zone run in its VM, the server's by default.
+	class Luawrapper * getLua();
+	void setLua(class Luawrapper * lua);
 
 	/* Called by Character only */
 
@@ -46,16 +92,60 @@ public:
 	// Remove the character from the zone and broadcast it.
 	void exitCharacter(class Character * character);
 
-	// Broadcast the new position and aspect of the character.
+	// Broadcast the new position of the character to whoever sees it,
+	// and send enter/leave-view updates to both sides.
+	void moveCharacter(class Character * character, int old_x, int old_y);
+
+	// Broadcast the aspect of the character to whoever sees it.
 	void updateCharacter(class Character * character);
 
 private:
+	friend class Place;
+
 	class Server * server;
 	std::string id;
 	unsigned int width;
 	unsigned int height;
-	std::vector<class Place> places;
+
+	/* Places, chunk by chunk: see index(). Few have scripts or tags. */
+	std::vector<Aspect> aspects;
+	std::vector<bool> walkable;
+	Registry<std::size_t, Script> whenWalkOn;
+	Registry<std::size_t, Tagged> tags;
+
+	// Read from files before any zone is touched.
+	struct PlaceScript { std::uint32_t x; std::uint32_t y; Script script; };
+	struct PlaceTag { std::uint32_t x; std::uint32_t y; TagID id; TagValue value; };
+	static void readTags(class BinaryReader& file, std::vector<struct PlaceTag>& tags); // As saveTags() writes them.
+	void setTags(const std::vector<struct PlaceTag>& tags);
+
 	std::list<Uuid> characters;
 
+	/* Floor cache */
+	unsigned long revision = 0; // Incremented by updatePlaceAspect().
+	struct Floor { bool valid; unsigned long revision; unsigned long aspects; std::string data; };
+	Floor floors[2] {};
+
+	/* Chunks */
+	unsigned int chunks_width;
+	unsigned int chunks_height;
+	struct Chunk { unsigned int holders; Floor floor; };
+	std::vector<struct Chunk> chunks;
+
+	std::size_t index(int x, int y); // Of the place in the arrays.
+	void position(std::size_t index, int& x, int& y); // Reverse of index().
+	void encode(std::string& out, int x, int y, int w, int h, bool rle);
+
+	/* Interest management: characters indexed by cell. */
+	unsigned int view_radius = 0;
+
+	class Luawrapper * lua = nullptr; // Own VM, or nullptr for the server's.
+	unsigned int cells_width;
+	std::vector<std::vector<class Character *>> cells;
+
 	class Character * getCharacter(Uuid id); // Auto remove if invalid.
+
+	std::vector<class Character *>& getCell(int x, int y);
+	bool sees(class Character * character, int x, int y);
+	std::vector<class Character *> getViewers(int x, int y); // Characters seeing x-y.
 };